@@ -1,9 +1,35 @@
 #include "Stdafx.hpp"
 #include "Buffer.hpp"
+#include <algorithm>
+#include <atomic>
 #include <sstream>
+#include <utility>
 #include <assert.h>
 
-CBuffer::CBuffer() : m_width(-1), m_height(-1), m_pixelSize(0)
+namespace
+{
+    // Versions made by NewUniqueVersion() have the top bit set, so they never
+    // collide with hashed input versions.
+    const unsigned long long kUniqueVersionBit = 1ULL << 63;
+
+    // CTripleBuffer::m_pending holds a slot index and this flag
+    const unsigned int kSlotMask = 3;
+    const unsigned int kFreshBit = 4;
+
+    // U and V of a black pixel
+    const unsigned char kChromaZero = 128;
+}
+
+SFrameMemory::SFrameMemory() : bytes(0), slabs(0)
+{
+}
+
+SBufferFrames::SBufferFrames() : shownVersion(0), freshVersion(0), fresh(false)
+{
+}
+
+CBuffer::CBuffer() : m_latestVersion(0), m_width(-1), m_height(-1), m_pixelSize(0),
+                     m_rowAlignment(1), m_layout(LAYOUT_PACKED)
 {
 }
 
@@ -24,8 +50,7 @@ void CBuffer::CheckSize(size_t size)
 
 void CBuffer::InitIntermediateBufferWithZero()
 {
-    unsigned char* ptr = GetIntermediateBuffer();
-    memset(ptr, 0, GetSize());
+    ClearFrame(GetIntermediateBuffer());
 }
 
 void CBuffer::InitIntermediateBuffer(const unsigned char* data, size_t size)
@@ -34,16 +59,69 @@ void CBuffer::InitIntermediateBuffer(const unsigned char* data, size_t size)
     memcpy(GetIntermediateBuffer(), data, size);
 }
 
+unsigned long long CBuffer::MakeVersion(const void* inputs, size_t size)
+{
+    // 64-bit FNV-1a
+    const unsigned char* bytes = static_cast<const unsigned char*>(inputs);
+    unsigned long long hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    hash &= ~kUniqueVersionBit;
+    return hash ? hash : 1;
+}
+
+unsigned long long CBuffer::NewUniqueVersion()
+{
+    static std::atomic<unsigned long long> counter(0);
+    return kUniqueVersionBit | ++counter;
+}
+
+unsigned long long CBuffer::GetLatestVersion() const
+{
+    return m_latestVersion;
+}
+
+void CBuffer::SetLatestVersion(unsigned long long version)
+{
+    m_latestVersion = version;
+}
+
 void CBuffer::SetTextureSize(int width, int height)
 {
     assert(m_pixelSize);
 
-    const size_t newSize = width * height * m_pixelSize;
-
-    CreateResource(newSize);
+    CreateResource(GetFrameSize(width, height));
 
     m_width = width;
     m_height = height;
+    // whatever was produced before doesn't match the new size
+    m_latestVersion = 0;
+}
+
+void CBuffer::MoveFramesFrom(CBuffer& other)
+{
+    m_pixelSize = other.m_pixelSize;
+    m_rowAlignment = other.m_rowAlignment;
+    m_layout = other.m_layout;
+    m_width = other.m_width;
+    m_height = other.m_height;
+    m_latestVersion = 0;
+
+    // never sized, so there is nothing to move
+    if (m_width <= 0)
+    {
+        return;
+    }
+
+    SBufferFrames frames;
+    other.ReleaseFrames(frames);
+    AdoptFrames(frames);
+    SetLatestVersion(frames.fresh ? frames.freshVersion : frames.shownVersion);
 }
 
 void CBuffer::SetPixelSize(int pixelSize)
@@ -51,9 +129,19 @@ void CBuffer::SetPixelSize(int pixelSize)
     m_pixelSize = pixelSize;
 }
 
+void CBuffer::SetRowAlignment(int alignment)
+{
+    m_rowAlignment = alignment;
+}
+
+void CBuffer::SetLayout(FRAME_LAYOUT layout)
+{
+    m_layout = layout;
+}
+
 int CBuffer::GetSize() const
 {
-    return m_width * m_height * m_pixelSize;
+    return GetFrameSize(m_width, m_height);
 }
 
 int CBuffer::GetRowSize() const
@@ -61,6 +149,139 @@ int CBuffer::GetRowSize() const
     return m_width * m_pixelSize;
 }
 
+int CBuffer::GetStride() const
+{
+    return AlignRow(GetRowSize());
+}
+
+int CBuffer::GetRowAlignment() const
+{
+    return m_rowAlignment;
+}
+
+FRAME_LAYOUT CBuffer::GetLayout() const
+{
+    return m_layout;
+}
+
+int CBuffer::GetPlaneCount() const
+{
+    return m_layout == LAYOUT_YUV420 ? 3 : 1;
+}
+
+int CBuffer::GetPlaneWidth(int plane) const
+{
+    int width, height;
+    GetPlaneSize(plane, m_width, m_height, width, height);
+    return width;
+}
+
+int CBuffer::GetPlaneHeight(int plane) const
+{
+    int width, height;
+    GetPlaneSize(plane, m_width, m_height, width, height);
+    return height;
+}
+
+int CBuffer::GetPlaneStride(int plane) const
+{
+    return AlignRow(GetPlaneWidth(plane) * m_pixelSize);
+}
+
+int CBuffer::GetPlaneOffset(int plane) const
+{
+    int offset = 0;
+    for (int i = 0; i < plane; ++i)
+    {
+        offset += GetPlaneStride(i) * GetPlaneHeight(i);
+    }
+    return offset;
+}
+
+int CBuffer::GetPlanes(unsigned char* frame, unsigned char* planes[kMaxFramePlanes],
+                       int strides[kMaxFramePlanes]) const
+{
+    const int count = GetPlaneCount();
+    for (int plane = 0; plane < count; ++plane)
+    {
+        planes[plane] = frame + GetPlaneOffset(plane);
+        strides[plane] = GetPlaneStride(plane);
+    }
+    return count;
+}
+
+void CBuffer::ClearFrame(unsigned char* frame) const
+{
+    const int count = GetPlaneCount();
+    for (int plane = 0; plane < count; ++plane)
+    {
+        memset(frame + GetPlaneOffset(plane), plane == 0 ? 0 : kChromaZero,
+               GetPlaneStride(plane) * GetPlaneHeight(plane));
+    }
+}
+
+void CBuffer::GetPlaneSize(int plane, int width, int height, int& planeWidth,
+                           int& planeHeight) const
+{
+    // odd sizes round the chroma up, like the decoder does
+    const bool subsampled = m_layout == LAYOUT_YUV420 && plane > 0;
+    planeWidth = subsampled ? (width + 1) / 2 : width;
+    planeHeight = subsampled ? (height + 1) / 2 : height;
+}
+
+int CBuffer::AlignRow(int bytes) const
+{
+    return (bytes + m_rowAlignment - 1) / m_rowAlignment * m_rowAlignment;
+}
+
+int CBuffer::GetFrameSize(int width, int height) const
+{
+    const int count = GetPlaneCount();
+    int size = 0;
+    for (int plane = 0; plane < count; ++plane)
+    {
+        int planeWidth, planeHeight;
+        GetPlaneSize(plane, width, height, planeWidth, planeHeight);
+        size += AlignRow(planeWidth * m_pixelSize) * planeHeight;
+    }
+    return size;
+}
+
+void CBuffer::ReserveSlab(CFrameSlab& slab, size_t size)
+{
+    if (slab.GetCapacity() < size || slab.GetCapacity() / 2 > size)
+    {
+        slab = CFramePool::GetInstance().Acquire(size);
+    }
+}
+
+void CBuffer::AdoptSlab(SBufferFrames& frames, size_t index, CFrameSlab& slab) const
+{
+    // without one to adopt the slot keeps its own slab
+    if (index < frames.slabs.size() && frames.slabs[index].GetCapacity())
+    {
+        slab = std::move(frames.slabs[index]);
+    }
+    ReserveSlab(slab, GetSize());
+}
+
+void CBuffer::AddSlab(const CFrameSlab& slab, SFrameMemory& memory)
+{
+    if (slab.GetCapacity())
+    {
+        memory.bytes += slab.GetCapacity();
+        memory.slabs++;
+    }
+}
+
+void CBuffer::ZeroSlab(const CFrameSlab& slab) const
+{
+    if (! slab.IsZero() || m_layout != LAYOUT_PACKED)
+    {
+        ClearFrame(slab.GetData());
+    }
+}
+
 int CBuffer::GetWidth() const
 {
     return m_width;
@@ -79,107 +300,316 @@ int CBuffer::GetPixelSize() const
 // -----------------------------------------------------------------------------
 // CSingleBuffer Functions
 // -----------------------------------------------------------------------------
+CSingleBuffer::CSingleBuffer() : m_version(0)
+{
+}
+
 void CSingleBuffer::CreateResource(size_t newSize)
 {
-    if (newSize != GetSize())
-    {
-        m_buffer.reset(new unsigned char[newSize]);
-    }
+    ReserveSlab(m_buffer, newSize);
+}
+
+void CSingleBuffer::ReleaseFrames(SBufferFrames& frames)
+{
+    frames.slabs.push_back(std::move(m_buffer));
+    frames.shownVersion = m_version;
+}
+
+void CSingleBuffer::AdoptFrames(SBufferFrames& frames)
+{
+    // there is no consumer to hand a frame to, the newest one is kept
+    AdoptSlab(frames, frames.fresh ? 1 : 0, m_buffer);
+    m_version = frames.fresh ? frames.freshVersion : frames.shownVersion;
 }
 
 unsigned char* CSingleBuffer::GetWorkingBuffer() const
 {
-    return m_buffer.get();
+    return m_buffer.GetData();
 }
 
 unsigned char* CSingleBuffer::GetStableBuffer() const
 {
-    return m_buffer.get();
+    return m_buffer.GetData();
 }
 
 unsigned char* CSingleBuffer::GetIntermediateBuffer() const
 {
-    return m_buffer.get();
+    return m_buffer.GetData();
+}
+
+void CSingleBuffer::InitIntermediateBufferWithZero()
+{
+    ZeroSlab(m_buffer);
+    SetWorkingVersion(NewUniqueVersion());
+}
+
+void CSingleBuffer::InitIntermediateBuffer(const unsigned char* data, size_t size)
+{
+    CBuffer::InitIntermediateBuffer(data, size);
+    SetWorkingVersion(NewUniqueVersion());
+}
+
+void CSingleBuffer::SetWorkingVersion(unsigned long long version)
+{
+    m_version = version;
+    SetLatestVersion(version);
+}
+
+unsigned long long CSingleBuffer::GetWorkingVersion() const
+{
+    return m_version;
+}
+
+unsigned long long CSingleBuffer::GetStableVersion() const
+{
+    return m_version;
+}
+
+void CSingleBuffer::AddStorage(SFrameMemory& memory) const
+{
+    AddSlab(m_buffer, memory);
+}
+
+// -----------------------------------------------------------------------------
+// CWorkerBuffer Functions
+// -----------------------------------------------------------------------------
+SHandoffStats::SHandoffStats()
+{
+    clock.start();
+    Reset();
+}
+
+void SHandoffStats::Reset()
+{
+    publishedFrames = 0;
+    displayedFrames = 0;
+    droppedFrames = 0;
+    latencyNsTotal = 0;
+    latencyNsMax = 0;
+}
+
+CWorkerBuffer::CWorkerBuffer() : m_stats(nullptr)
+{
+}
+
+void CWorkerBuffer::SetHandoffPolicy(HANDOFF_POLICY)
+{
+}
+
+void CWorkerBuffer::SetHandoffStats(SHandoffStats* stats)
+{
+    m_stats = stats;
+}
+
+qint64 CWorkerBuffer::RecordPublished()
+{
+    if (! m_stats)
+        return 0;
+
+    m_stats->publishedFrames++;
+    return m_stats->clock.nsecsElapsed();
+}
+
+void CWorkerBuffer::RecordDropped()
+{
+    if (m_stats)
+        m_stats->droppedFrames++;
+}
+
+void CWorkerBuffer::RecordDisplayed(qint64 publishNs)
+{
+    if (! m_stats)
+        return;
+
+    const unsigned long long latencyNs = m_stats->clock.nsecsElapsed() - publishNs;
+    m_stats->displayedFrames++;
+    m_stats->latencyNsTotal += latencyNs;
+
+    unsigned long long maxNs = m_stats->latencyNsMax;
+    while (latencyNs > maxNs && ! m_stats->latencyNsMax.compare_exchange_weak(maxNs, latencyNs))
+    {
+    }
 }
 
 // -----------------------------------------------------------------------------
 // CTripleBuffer Functions
 // -----------------------------------------------------------------------------
-CTripleBuffer::CTripleBuffer() : m_workingCopyEmpty(true)
+CTripleBuffer::CTripleBuffer(HANDOFF_POLICY policy) : m_policy(policy),
+                                                      m_working(0), m_stable(1),
+                                                      m_pending(2)
 {
+    for (int i = 0; i < 3; ++i)
+    {
+        m_versions[i] = 0;
+        m_publishNs[i] = 0;
+    }
 }
 
 CTripleBuffer::~CTripleBuffer()
 {
 }
 
+void CTripleBuffer::SetHandoffPolicy(HANDOFF_POLICY policy)
+{
+    m_policy = policy;
+}
+
 void CTripleBuffer::CreateResource(size_t newSize)
 {
-    if (newSize != GetSize())
+    for (auto& slot : m_slots)
+    {
+        ReserveSlab(slot, newSize);
+    }
+}
+
+void CTripleBuffer::ReleaseFrames(SBufferFrames& frames)
+{
+    const unsigned int pending = m_pending;
+    const int pendingSlot = pending & kSlotMask;
+
+    frames.slabs.push_back(std::move(m_slots[m_stable]));
+    frames.slabs.push_back(std::move(m_slots[pendingSlot]));
+    frames.slabs.push_back(std::move(m_slots[m_working]));
+    frames.shownVersion = m_versions[m_stable];
+    frames.freshVersion = m_versions[pendingSlot];
+    frames.fresh = (pending & kFreshBit) != 0;
+}
+
+void CTripleBuffer::AdoptFrames(SBufferFrames& frames)
+{
+    m_working = 0;
+    m_stable = 1;
+    AdoptSlab(frames, 0, m_slots[m_stable]);
+    AdoptSlab(frames, 1, m_slots[2]);
+    AdoptSlab(frames, 2, m_slots[m_working]);
+
+    m_versions[m_stable] = frames.shownVersion;
+    m_versions[2] = frames.fresh ? frames.freshVersion : 0;
+    m_versions[m_working] = 0;
+
+    if (frames.fresh)
+    {
+        m_publishNs[2] = RecordPublished();
+        m_pending = 2 | kFreshBit;
+    }
+    else
     {
-        m_working.reset(new unsigned char[newSize]);
-        m_stable.reset(new unsigned char[newSize]);
-        m_workingCopy.reset(new unsigned char[newSize]);
+        m_pending = 2;
     }
 }
 
+void CTripleBuffer::Publish()
+{
+    const unsigned long long version = m_versions[m_working];
+    // the render thread may take the slot right after the exchange
+    m_publishNs[m_working] = RecordPublished();
+    const unsigned int old = m_pending.exchange(m_working | kFreshBit);
+
+    // a pending frame which was never displayed is dropped (latest-wins)
+    if (old & kFreshBit)
+        RecordDropped();
+    m_working = old & kSlotMask;
+    SetLatestVersion(version);
+}
+
 void CTripleBuffer::InitIntermediateBufferWithZero()
 {
-    memset(m_workingCopy.get(), 0, GetSize());
-    m_workingCopyEmpty = false;
+    ZeroSlab(m_slots[m_working]);
+    m_versions[m_working] = NewUniqueVersion();
+    Publish();
 }
 
 void CTripleBuffer::InitIntermediateBuffer(const unsigned char* data, size_t size)
 {
     CheckSize(size);
-    memcpy(m_workingCopy.get(), data, size);
-    m_workingCopyEmpty = false;
+    if (data != GetWorkingBuffer())
+    {
+        memcpy(GetWorkingBuffer(), data, size);
+    }
+    m_versions[m_working] = NewUniqueVersion();
+    // m_pending may already point elsewhere once the render thread has taken
+    // the frame, the published slot stays as it is until the next Publish()
+    const int published = m_working;
+    Publish();
+
+    // the producer continues from the data, e.g. refines a partial result
+    memcpy(GetWorkingBuffer(), m_slots[published].GetData(), size);
 }
 
 void CTripleBuffer::InitAllInternalBuffers(const unsigned char* data, size_t size)
 {
     CheckSize(size);
-    memcpy(m_stable.get(), data, size);
-    memcpy(m_workingCopy.get(), data, size);
-    memcpy(m_working.get(), data, size);
-    m_workingCopyEmpty = false;
+    const unsigned long long version = NewUniqueVersion();
+    for (int i = 0; i < 3; ++i)
+    {
+        memcpy(m_slots[i].GetData(), data, size);
+        m_versions[i] = version;
+    }
+    m_working = 0;
+    m_stable = 1;
+    m_publishNs[2] = RecordPublished();
+    m_pending = 2 | kFreshBit;
+    SetLatestVersion(version);
+}
+
+void CTripleBuffer::SetWorkingVersion(unsigned long long version)
+{
+    m_versions[m_working] = version;
+}
+
+unsigned long long CTripleBuffer::GetWorkingVersion() const
+{
+    return m_versions[m_working];
+}
+
+unsigned long long CTripleBuffer::GetStableVersion() const
+{
+    return m_versions[m_stable];
+}
+
+void CTripleBuffer::AddStorage(SFrameMemory& memory) const
+{
+    for (auto& slot : m_slots)
+    {
+        AddSlab(slot, memory);
+    }
 }
 
 unsigned char* CTripleBuffer::GetWorkingBuffer() const
 {
-    return m_working.get();
+    return m_slots[m_working].GetData();
 }
 
 unsigned char* CTripleBuffer::GetStableBuffer() const
 {
-    return m_stable.get();
+    return m_slots[m_stable].GetData();
 }
 
 unsigned char* CTripleBuffer::GetIntermediateBuffer() const
 {
-    return m_workingCopy.get();
+    return m_slots[m_pending & kSlotMask].GetData();
 }
 
 bool CTripleBuffer::CanWeSwapWorkingBuffer()
 {
-    return m_workingCopyEmpty;
+    return m_policy == HANDOFF_LATEST || ! (m_pending & kFreshBit);
 }
 
 bool CTripleBuffer::CanWeSwapStableBuffer()
 {
-    return ! m_workingCopyEmpty;
+    return (m_pending & kFreshBit) != 0;
 }
 
 void CTripleBuffer::SwapWorkingBuffer()
 {
-    m_working.swap(m_workingCopy);
-    m_workingCopyEmpty = false;
+    Publish();
 }
 
 void CTripleBuffer::SwapStableBuffer()
 {
-    m_stable.swap(m_workingCopy);
-    m_workingCopyEmpty = true;
+    const unsigned int old = m_pending.exchange(m_stable);
+    m_stable = old & kSlotMask;
+    RecordDisplayed(m_publishNs[m_stable]);
 }
 
 void CTripleBuffer::SetWorkingBufferFull()
@@ -189,7 +619,8 @@ void CTripleBuffer::SetWorkingBufferFull()
 // -----------------------------------------------------------------------------
 // CDoubleBuffer Functions
 // -----------------------------------------------------------------------------
-CDoubleBuffer::CDoubleBuffer(): m_workFull(false)
+CDoubleBuffer::CDoubleBuffer(): m_workFull(false), m_publishNs(0),
+                                m_workingVersion(0), m_stableVersion(0)
 {
 }
 
@@ -199,46 +630,92 @@ CDoubleBuffer::~CDoubleBuffer()
 
 void CDoubleBuffer::CreateResource(size_t newSize)
 {
-    if (newSize != GetSize())
-    {
-        m_working.reset(new unsigned char[newSize]);
-        m_stable.reset(new unsigned char[newSize]);
-    }
+    ReserveSlab(m_working, newSize);
+    ReserveSlab(m_stable, newSize);
+}
+
+void CDoubleBuffer::ReleaseFrames(SBufferFrames& frames)
+{
+    frames.slabs.push_back(std::move(m_stable));
+    frames.slabs.push_back(std::move(m_working));
+    frames.shownVersion = m_stableVersion;
+    frames.freshVersion = m_workingVersion;
+    frames.fresh = m_workFull;
+}
+
+void CDoubleBuffer::AdoptFrames(SBufferFrames& frames)
+{
+    // The producer writes the working buffer right away, so a frame the
+    // consumer didn't take yet becomes the stable one. The render thread
+    // uploads it as it has a new version.
+    const size_t newest = frames.fresh ? 1 : 0;
+    AdoptSlab(frames, newest, m_stable);
+    AdoptSlab(frames, 1 - newest, m_working);
+    m_stableVersion = frames.fresh ? frames.freshVersion : frames.shownVersion;
+    m_workingVersion = 0;
+    m_workFull = false;
 }
 
 void CDoubleBuffer::InitIntermediateBufferWithZero()
 {
-    memset(m_stable.get(), 0, GetSize());
+    ZeroSlab(m_stable);
     m_workFull = false;
+    m_stableVersion = NewUniqueVersion();
+    SetLatestVersion(m_stableVersion);
 }
 
 void CDoubleBuffer::InitIntermediateBuffer(const unsigned char* data, size_t size)
 {
     CheckSize(size);
-    memcpy(m_stable.get(), data, size);
+    memcpy(m_stable.GetData(), data, size);
     m_workFull = false;
+    m_stableVersion = NewUniqueVersion();
+    SetLatestVersion(m_stableVersion);
 }
 
 void CDoubleBuffer::InitAllInternalBuffers(const unsigned char* data, size_t size)
 {
     CheckSize(size);
-    memcpy(m_working.get(), data, size);
-    memcpy(m_stable.get(), data, size);
+    memcpy(m_working.GetData(), data, size);
+    memcpy(m_stable.GetData(), data, size);
+    m_workingVersion = m_stableVersion = NewUniqueVersion();
+    SetLatestVersion(m_stableVersion);
+}
+
+void CDoubleBuffer::SetWorkingVersion(unsigned long long version)
+{
+    m_workingVersion = version;
+}
+
+unsigned long long CDoubleBuffer::GetWorkingVersion() const
+{
+    return m_workingVersion;
+}
+
+unsigned long long CDoubleBuffer::GetStableVersion() const
+{
+    return m_stableVersion;
+}
+
+void CDoubleBuffer::AddStorage(SFrameMemory& memory) const
+{
+    AddSlab(m_working, memory);
+    AddSlab(m_stable, memory);
 }
 
 unsigned char* CDoubleBuffer::GetWorkingBuffer() const
 {
-    return m_working.get();
+    return m_working.GetData();
 }
 
 unsigned char* CDoubleBuffer::GetStableBuffer() const
 {
-    return m_stable.get();
+    return m_stable.GetData();
 }
 
 unsigned char* CDoubleBuffer::GetIntermediateBuffer() const
 {
-    return m_working.get();
+    return m_working.GetData();
 }
 
 bool CDoubleBuffer::CanWeSwapWorkingBuffer()
@@ -259,15 +736,247 @@ void CDoubleBuffer::SwapWorkingBuffer()
 
 void CDoubleBuffer::SwapStableBuffer()
 {
-    m_stable.swap(m_working);
+    m_stable.Swap(m_working);
+    std::swap(m_stableVersion, m_workingVersion);
+    RecordDisplayed(m_publishNs);
+    // hands the working buffer back to the producer
     m_workFull = false;
 }
 
 void CDoubleBuffer::SetWorkingBufferFull()
 {
+    m_publishNs = RecordPublished();
+    SetLatestVersion(m_workingVersion);
     m_workFull = true;
 }
 
+// -----------------------------------------------------------------------------
+// CRingBuffer Functions
+// -----------------------------------------------------------------------------
+CRingBuffer::CRingBuffer(int depth) : m_slots(std::max(depth, 1) + 2),
+                                      m_versions(m_slots.size(), 0),
+                                      m_publishNs(m_slots.size(), 0),
+                                      m_head(1), m_tail(0)
+{
+}
+
+CRingBuffer::~CRingBuffer()
+{
+}
+
+void CRingBuffer::CreateResource(size_t newSize)
+{
+    for (auto& slot : m_slots)
+    {
+        ReserveSlab(slot, newSize);
+    }
+
+    if (newSize != GetSize())
+    {
+        // queued frames of the old size are gone
+        m_tail = Next(m_head, -1);
+    }
+}
+
+void CRingBuffer::ReleaseFrames(SBufferFrames& frames)
+{
+    const int stableSlot = GetSlot(m_tail);
+    const int newestSlot = GetSlot(Next(m_head, -1));
+
+    // queued frames between the two are dropped, their slabs are spare
+    frames.fresh = GetQueuedFrames() > 0;
+    frames.shownVersion = m_versions[stableSlot];
+    frames.freshVersion = m_versions[newestSlot];
+    frames.slabs.push_back(std::move(m_slots[stableSlot]));
+    if (frames.fresh)
+    {
+        frames.slabs.push_back(std::move(m_slots[newestSlot]));
+    }
+
+    for (auto& slot : m_slots)
+    {
+        if (slot.GetCapacity())
+        {
+            frames.slabs.push_back(std::move(slot));
+        }
+    }
+}
+
+void CRingBuffer::AdoptFrames(SBufferFrames& frames)
+{
+    const unsigned int tail = Next(m_head, frames.fresh ? -2 : -1);
+    const int stableSlot = GetSlot(tail);
+    const int freshSlot = GetSlot(Next(tail, 1));
+
+    AdoptSlab(frames, 0, m_slots[stableSlot]);
+    m_versions[stableSlot] = frames.shownVersion;
+
+    size_t next = 1;
+    if (frames.fresh)
+    {
+        AdoptSlab(frames, next++, m_slots[freshSlot]);
+        m_versions[freshSlot] = frames.freshVersion;
+        m_publishNs[freshSlot] = RecordPublished();
+    }
+
+    for (int i = 0; i < static_cast<int>(m_slots.size()); ++i)
+    {
+        if (i != stableSlot && (i != freshSlot || ! frames.fresh))
+        {
+            AdoptSlab(frames, next++, m_slots[i]);
+            m_versions[i] = 0;
+        }
+    }
+
+    m_tail = tail;
+}
+
+unsigned int CRingBuffer::Next(unsigned int count, int step) const
+{
+    const unsigned int range = 2 * static_cast<unsigned int>(m_slots.size());
+    return (count + range + step) % range;
+}
+
+int CRingBuffer::GetSlot(unsigned int count) const
+{
+    return count % m_slots.size();
+}
+
+void CRingBuffer::MakeRoom()
+{
+    // Only a paused producer gets here with a full queue, the oldest frame
+    // goes
+    if (! CanWeSwapWorkingBuffer())
+    {
+        m_tail = Next(m_tail, 1);
+    }
+}
+
+void CRingBuffer::Publish()
+{
+    const unsigned int head = m_head;
+    m_publishNs[GetSlot(head)] = RecordPublished();
+    SetLatestVersion(m_versions[GetSlot(head)]);
+    m_head = Next(head, 1);
+}
+
+void CRingBuffer::InitIntermediateBufferWithZero()
+{
+    MakeRoom();
+    ZeroSlab(m_slots[GetSlot(m_head)]);
+    m_versions[GetSlot(m_head)] = NewUniqueVersion();
+    Publish();
+}
+
+void CRingBuffer::InitIntermediateBuffer(const unsigned char* data, size_t size)
+{
+    CheckSize(size);
+    MakeRoom();
+
+    if (data != GetWorkingBuffer())
+    {
+        memcpy(GetWorkingBuffer(), data, size);
+    }
+    m_versions[GetSlot(m_head)] = NewUniqueVersion();
+    Publish();
+
+    // the producer continues from the data, e.g. refines a partial result
+    memcpy(GetWorkingBuffer(), GetIntermediateBuffer(), size);
+}
+
+void CRingBuffer::InitAllInternalBuffers(const unsigned char* data, size_t size)
+{
+    CheckSize(size);
+    const unsigned long long version = NewUniqueVersion();
+    for (size_t i = 0; i < m_slots.size(); ++i)
+    {
+        memcpy(m_slots[i].GetData(), data, size);
+        m_versions[i] = version;
+    }
+
+    // the stable slot already holds the data, nothing is queued
+    m_tail = Next(m_head, -1);
+    SetLatestVersion(version);
+}
+
+void CRingBuffer::SetWorkingVersion(unsigned long long version)
+{
+    m_versions[GetSlot(m_head)] = version;
+}
+
+unsigned long long CRingBuffer::GetWorkingVersion() const
+{
+    return m_versions[GetSlot(m_head)];
+}
+
+unsigned long long CRingBuffer::GetStableVersion() const
+{
+    return m_versions[GetSlot(m_tail)];
+}
+
+void CRingBuffer::AddStorage(SFrameMemory& memory) const
+{
+    for (auto& slot : m_slots)
+    {
+        AddSlab(slot, memory);
+    }
+}
+
+unsigned char* CRingBuffer::GetWorkingBuffer() const
+{
+    return m_slots[GetSlot(m_head)].GetData();
+}
+
+unsigned char* CRingBuffer::GetStableBuffer() const
+{
+    return m_slots[GetSlot(m_tail)].GetData();
+}
+
+unsigned char* CRingBuffer::GetIntermediateBuffer() const
+{
+    return m_slots[GetSlot(Next(m_head, -1))].GetData();
+}
+
+bool CRingBuffer::CanWeSwapWorkingBuffer()
+{
+    // the next working slot must not be the stable one
+    return GetQueuedFrames() < GetDepth();
+}
+
+bool CRingBuffer::CanWeSwapStableBuffer()
+{
+    return GetQueuedFrames() > 0;
+}
+
+void CRingBuffer::SwapWorkingBuffer()
+{
+    Publish();
+}
+
+void CRingBuffer::SwapStableBuffer()
+{
+    const unsigned int tail = Next(m_tail, 1);
+    RecordDisplayed(m_publishNs[GetSlot(tail)]);
+    // frees the old stable slot for the producer
+    m_tail = tail;
+}
+
+void CRingBuffer::SetWorkingBufferFull()
+{
+}
+
+int CRingBuffer::GetDepth() const
+{
+    return static_cast<int>(m_slots.size()) - 2;
+}
+
+int CRingBuffer::GetQueuedFrames() const
+{
+    // the distance from tail to head is below 2 * slot count
+    const unsigned int distance = Next(m_head, -static_cast<int>(m_tail));
+    return static_cast<int>(distance) - 1;
+}
+
 // -----------------------------------------------------------------------------
 // Helper Functions
 // -----------------------------------------------------------------------------
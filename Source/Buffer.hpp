@@ -1,9 +1,76 @@
 #ifndef BUFFER_HPP
 #define BUFFER_HPP
 
-#include <memory>
+#include <QElapsedTimer>
+#include <atomic>
+#include <vector>
+#include "FramePool.hpp"
 
-typedef std::unique_ptr<unsigned char[]> u_data_ptr;
+/**
+ * How a worker hands finished frames to the render thread when the previous
+ * one is still pending. FIFO makes the worker wait until it was displayed,
+ * latest-wins overwrites it, so the worker never blocks.
+ */
+enum HANDOFF_POLICY
+{
+    HANDOFF_FIFO = 0,
+    HANDOFF_LATEST
+};
+
+// How the bytes of a frame are laid out
+enum FRAME_LAYOUT
+{
+    // one plane of GetPixelSize() bytes per pixel
+    LAYOUT_PACKED = 0,
+    // Y, U and V planes of a byte per sample, U and V at half the width and
+    // height, as most movies are decoded
+    LAYOUT_YUV420
+};
+
+// Planes of a frame at most
+const int kMaxFramePlanes = 3;
+
+/**
+ * Frames handed from a worker to the render thread. Latency is the time
+ * from publishing a frame to the render thread picking it up.
+ */
+struct SHandoffStats
+{
+    SHandoffStats();
+    void Reset();
+
+    QElapsedTimer clock;
+    std::atomic<unsigned long long> publishedFrames;
+    std::atomic<unsigned long long> displayedFrames;
+    std::atomic<unsigned long long> droppedFrames;
+    std::atomic<unsigned long long> latencyNsTotal;
+    std::atomic<unsigned long long> latencyNsMax;
+};
+
+/**
+ * Storage handed from one buffer to another when the buffer mode changes,
+ * so no frame is copied. slabs[0] holds the frame on screen, slabs[1] a
+ * newer one the consumer didn't take yet if fresh is set. The rest are
+ * spare and their content is of no use.
+ */
+struct SBufferFrames
+{
+    SBufferFrames();
+
+    std::vector<CFrameSlab> slabs;
+    unsigned long long shownVersion;
+    unsigned long long freshVersion;
+    bool fresh;
+};
+
+// Frame storage held by a buffer or a texture object
+struct SFrameMemory
+{
+    SFrameMemory();
+
+    unsigned long long bytes;
+    int slabs;
+};
 
 class CBuffer
 {
@@ -18,56 +85,166 @@ public:
     virtual void InitIntermediateBufferWithZero();
     virtual void InitIntermediateBuffer(const unsigned char* data, size_t size);
 
+    /**
+     * Content versions identify what a buffer holds, e.g. a hash of the
+     * inputs which produced it. 0 means "no content". Producers tag the
+     * working buffer, the version travels with the buffer on every swap.
+     */
+    static unsigned long long MakeVersion(const void* inputs, size_t size);
+    static unsigned long long NewUniqueVersion();
+
+    virtual void SetWorkingVersion(unsigned long long version) = 0;
+    virtual unsigned long long GetWorkingVersion() const = 0;
+    virtual unsigned long long GetStableVersion() const = 0;
+    // Version of the newest content handed over to the consumer
+    unsigned long long GetLatestVersion() const;
+
     void SetTextureSize(int width, int height);
     void SetPixelSize(int pixelSize);
+    // Pads rows to a multiple of alignment bytes, 1 means packed rows. Takes
+    // effect with the next SetTextureSize().
+    void SetRowAlignment(int alignment);
+    // Takes effect with the next SetTextureSize() as well
+    void SetLayout(FRAME_LAYOUT layout);
+    /**
+     * Takes over the size and the storage of @p other, which is left
+     * without any. The frame on screen stays on screen and a frame not
+     * displayed yet is still handed to the consumer. Missing slots come
+     * from the frame pool, slabs left over go back to it.
+     */
+    void MoveFramesFrom(CBuffer& other);
+    // Adds the slabs this buffer holds to @p memory
+    virtual void AddStorage(SFrameMemory& memory) const = 0;
 
+    // GetSize() includes the row padding and all planes
     int GetSize() const;
+    // of the first plane
     int GetRowSize() const;
+    int GetStride() const;
     int GetWidth() const;
     int GetHeight() const;
     int GetPixelSize() const;
+    int GetRowAlignment() const;
+    FRAME_LAYOUT GetLayout() const;
+
+    int GetPlaneCount() const;
+    int GetPlaneWidth(int plane) const;
+    int GetPlaneHeight(int plane) const;
+    int GetPlaneStride(int plane) const;
+    // Start of @p plane within a frame
+    int GetPlaneOffset(int plane) const;
+    // Fills @p planes and @p strides for @p frame, returns the plane count
+    int GetPlanes(unsigned char* frame, unsigned char* planes[kMaxFramePlanes],
+                  int strides[kMaxFramePlanes]) const;
+    // Black in the layout of the buffer, which isn't all zero for YUV
+    void ClearFrame(unsigned char* frame) const;
 
 protected:
     void CheckSize(size_t size);
+    void SetLatestVersion(unsigned long long version);
+    // Keeps the slab if it fits size without wasting half of it, otherwise
+    // takes another one from the frame pool
+    static void ReserveSlab(CFrameSlab& slab, size_t size);
+    static void AddSlab(const CFrameSlab& slab, SFrameMemory& memory);
+    // Clears the slab to black, skips the memset if it is still zero from
+    // the OS and zero is black
+    void ZeroSlab(const CFrameSlab& slab) const;
+
+    // Gives the slab at @p index of @p frames, or a pool slab if there is
+    // none, the right size for this buffer
+    void AdoptSlab(SBufferFrames& frames, size_t index, CFrameSlab& slab) const;
 
 private:
     virtual void CreateResource(size_t newSize) = 0;
+    // Moves all slabs out, in the order of SBufferFrames
+    virtual void ReleaseFrames(SBufferFrames& frames) = 0;
+    // Takes the slabs of @p frames, the size is already set
+    virtual void AdoptFrames(SBufferFrames& frames) = 0;
 
+    // For a frame of width x height, the size isn't set yet when resizing
+    void GetPlaneSize(int plane, int width, int height, int& planeWidth, int& planeHeight) const;
+    int AlignRow(int bytes) const;
+    int GetFrameSize(int width, int height) const;
+
+    unsigned long long m_latestVersion;
     int m_width;
     int m_height;
     int m_pixelSize;
+    int m_rowAlignment;
+    FRAME_LAYOUT m_layout;
 };
 
 class CSingleBuffer: public CBuffer
 {
 public:
+    CSingleBuffer();
+
     unsigned char* GetWorkingBuffer() const override;
     unsigned char* GetStableBuffer() const override;
     unsigned char* GetIntermediateBuffer() const override;
 
+    void InitIntermediateBufferWithZero() override;
+    void InitIntermediateBuffer(const unsigned char* data, size_t size) override;
+    void SetWorkingVersion(unsigned long long version) override;
+    unsigned long long GetWorkingVersion() const override;
+    unsigned long long GetStableVersion() const override;
+    void AddStorage(SFrameMemory& memory) const override;
+
 private:
     void CreateResource(size_t newSize) override;
+    void ReleaseFrames(SBufferFrames& frames) override;
+    void AdoptFrames(SBufferFrames& frames) override;
 
-    u_data_ptr m_buffer;
+    CFrameSlab m_buffer;
+    unsigned long long m_version;
 };
 
+/**
+ * Buffers shared by one worker (producer) and the render thread (consumer).
+ * The hand-off is lock-free: the producer calls CanWeSwapWorkingBuffer(),
+ * SetWorkingBufferFull() and SwapWorkingBuffer(), the consumer only
+ * CanWeSwapStableBuffer() and SwapStableBuffer(). Everything else needs the
+ * worker paused.
+ */
 class CWorkerBuffer: public CBuffer
 {
 public:
+    CWorkerBuffer();
+
     virtual bool CanWeSwapWorkingBuffer() = 0;
     virtual bool CanWeSwapStableBuffer() = 0;
     virtual void SwapWorkingBuffer() = 0;
     virtual void SwapStableBuffer() = 0;
     virtual void SetWorkingBufferFull() = 0;
     virtual void InitAllInternalBuffers(const unsigned char* data, size_t size) = 0;
+    // Buffers without a choice ignore it
+    virtual void SetHandoffPolicy(HANDOFF_POLICY policy);
+
+    void SetHandoffStats(SHandoffStats* stats);
+
+protected:
+    // Returns the publish time to store along with the frame
+    qint64 RecordPublished();
+    void RecordDropped();
+    void RecordDisplayed(qint64 publishNs);
+
+private:
+    SHandoffStats* m_stats;
 };
 
+/**
+ * Lock-free triple buffer. The producer owns the working slot, the consumer
+ * the stable slot, and the pending slot is traded between them through one
+ * atomic word holding its index and a flag for "not yet displayed".
+ */
 class CTripleBuffer: public CWorkerBuffer
 {
 public:
-    CTripleBuffer();
+    explicit CTripleBuffer(HANDOFF_POLICY policy = HANDOFF_FIFO);
     ~CTripleBuffer();
 
+    void SetHandoffPolicy(HANDOFF_POLICY policy) override;
+
     unsigned char* GetWorkingBuffer() const override;
     unsigned char* GetStableBuffer() const override;
     unsigned char* GetIntermediateBuffer() const override;
@@ -81,15 +258,28 @@ public:
     void SwapStableBuffer() override;
     void SetWorkingBufferFull() override;
     void InitAllInternalBuffers(const unsigned char* data, size_t size) override;
+    void SetWorkingVersion(unsigned long long version) override;
+    unsigned long long GetWorkingVersion() const override;
+    unsigned long long GetStableVersion() const override;
+    void AddStorage(SFrameMemory& memory) const override;
 
 private:
     void CreateResource(size_t newSize) override;
+    void ReleaseFrames(SBufferFrames& frames) override;
+    void AdoptFrames(SBufferFrames& frames) override;
+    // Makes the working slot the pending one, takes the old pending slot
+    void Publish();
+
+    HANDOFF_POLICY m_policy;
 
-    bool m_workingCopyEmpty;
+    CFrameSlab m_slots[3];
+    unsigned long long m_versions[3];
+    qint64 m_publishNs[3];
 
-    u_data_ptr m_working;
-    u_data_ptr m_stable;
-    u_data_ptr m_workingCopy;
+    int m_working;
+    int m_stable;
+    // pending slot index | kFreshBit while it was not displayed
+    std::atomic<unsigned int> m_pending;
 };
 
 class CDoubleBuffer: public CWorkerBuffer
@@ -111,14 +301,80 @@ public:
     void SwapStableBuffer() override;
     void SetWorkingBufferFull() override;
     void InitAllInternalBuffers(const unsigned char* data, size_t size) override;
+    void SetWorkingVersion(unsigned long long version) override;
+    unsigned long long GetWorkingVersion() const override;
+    unsigned long long GetStableVersion() const override;
+    void AddStorage(SFrameMemory& memory) const override;
+
+private:
+    void CreateResource(size_t newSize) override;
+    void ReleaseFrames(SBufferFrames& frames) override;
+    void AdoptFrames(SBufferFrames& frames) override;
+
+    // set by the producer, cleared by the consumer after swapping
+    std::atomic<bool> m_workFull;
+    qint64 m_publishNs;
+
+    CFrameSlab m_working;
+    CFrameSlab m_stable;
+
+    unsigned long long m_workingVersion;
+    unsigned long long m_stableVersion;
+};
+
+/**
+ * Lock-free single-producer single-consumer queue of up to @p depth finished
+ * frames, so the producer can run ahead of the consumer and absorb spikes in
+ * its frame time. Always FIFO. The consumer takes one frame per swap.
+ */
+class CRingBuffer: public CWorkerBuffer
+{
+public:
+    explicit CRingBuffer(int depth);
+    ~CRingBuffer();
+
+    unsigned char* GetWorkingBuffer() const override;
+    unsigned char* GetStableBuffer() const override;
+    // the newest finished frame
+    unsigned char* GetIntermediateBuffer() const override;
+
+    void InitIntermediateBufferWithZero() override;
+    void InitIntermediateBuffer(const unsigned char* data, size_t size) override;
+
+    bool CanWeSwapWorkingBuffer() override;
+    bool CanWeSwapStableBuffer() override;
+    void SwapWorkingBuffer() override;
+    void SwapStableBuffer() override;
+    void SetWorkingBufferFull() override;
+    void InitAllInternalBuffers(const unsigned char* data, size_t size) override;
+    void SetWorkingVersion(unsigned long long version) override;
+    unsigned long long GetWorkingVersion() const override;
+    unsigned long long GetStableVersion() const override;
+    void AddStorage(SFrameMemory& memory) const override;
+
+    int GetDepth() const;
+    // Finished frames waiting for the consumer
+    int GetQueuedFrames() const;
 
 private:
     void CreateResource(size_t newSize) override;
+    void ReleaseFrames(SBufferFrames& frames) override;
+    void AdoptFrames(SBufferFrames& frames) override;
+    unsigned int Next(unsigned int count, int step) const;
+    int GetSlot(unsigned int count) const;
+    void MakeRoom();
+    void Publish();
 
-    bool m_workFull;
+    std::vector<CFrameSlab> m_slots;
+    std::vector<unsigned long long> m_versions;
+    std::vector<qint64> m_publishNs;
 
-    u_data_ptr m_working;
-    u_data_ptr m_stable;
+    // Frame counters modulo twice the slot count, the slot of a frame is its
+    // count modulo the slot count. m_head is the working slot and only
+    // advanced by the producer, m_tail the stable slot and only advanced by
+    // the consumer. The frames in between are queued.
+    std::atomic<unsigned int> m_head;
+    std::atomic<unsigned int> m_tail;
 };
 
 /** Helper functions
@@ -0,0 +1,22 @@
+#include "Stdafx.hpp"
+#include "CancelToken.hpp"
+
+CCancelToken::CCancelToken(): m_cancelled(false)
+{
+}
+
+void CCancelToken::Cancel()
+{
+    m_cancelled = true;
+}
+
+void CCancelToken::Reset()
+{
+    m_cancelled = false;
+}
+
+bool CCancelToken::IsCancelled() const
+{
+    // Only a hint to stop early, the worker mutex orders everything else
+    return m_cancelled.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,32 @@
+#ifndef CANCELTOKEN_HPP
+#define CANCELTOKEN_HPP
+
+#include <atomic>
+
+// ----------------------------------------------------------------------------
+// Set by the render thread to drop the frame a producer is working on.
+// Producers check it between steps short enough to keep a pause or stop
+// below kMaxCancelLatencyUs: one slice of the scaler, one tile row of the
+// fractal. The video never waits for its decode stage within a frame.
+// ----------------------------------------------------------------------------
+
+const int kMaxCancelLatencyUs = 2000;
+
+class CCancelToken
+{
+public:
+    CCancelToken();
+
+    void Cancel();
+    // Before the next frame
+    void Reset();
+    bool IsCancelled() const;
+
+private:
+    CCancelToken(const CCancelToken&) = delete;
+    CCancelToken& operator=(const CCancelToken&) = delete;
+
+    std::atomic<bool> m_cancelled;
+};
+
+#endif // CANCELTOKEN_HPP
@@ -69,10 +69,70 @@ static const char *BASIC_VERTEX_SHADER =
     "    texc.y = 0.5 * (1.0 - vertex.y);\n"
     "}\n";
 
+// ----------------------------------------------------------------------------
+// Video colours of either frame layout
+// ----------------------------------------------------------------------------
+#include "TextureObject.hpp"
+
+static const char *VIDEO_SAMPLER_SHADER =
+    "uniform sampler2D videoTex;\n"
+    "uniform sampler2D videoUTex;\n"
+    "uniform sampler2D videoVTex;\n"
+    "uniform bool videoYuv;\n"
+    "vec4 videoColour(vec2 texc)\n"
+    "{\n"
+    "    if (! videoYuv)\n"
+    "        return texture2D(videoTex, texc);\n"
+    "\n"
+    "    // BT.601 with limited range, as sws_scale converts to BGRA\n"
+    "    float y = 1.164 * (texture2D(videoTex, texc).r - 0.0625);\n"
+    "    float u = texture2D(videoUTex, texc).r - 0.5;\n"
+    "    float v = texture2D(videoVTex, texc).r - 0.5;\n"
+    "    return vec4(y + 1.596 * v, y - 0.392 * u - 0.813 * v, y + 2.017 * u, 1.0);\n"
+    "}\n";
+
+const char* CVideoSampler::GetShaderSource()
+{
+    return VIDEO_SAMPLER_SHADER;
+}
+
+CVideoSampler::CVideoSampler(): m_yuvLoc(-1)
+{
+    std::fill(m_planeLocs, m_planeLocs + 3, -1);
+}
+
+void CVideoSampler::Init(QOpenGLShaderProgram& program)
+{
+    m_planeLocs[0] = program.uniformLocation("videoTex");
+    m_planeLocs[1] = program.uniformLocation("videoUTex");
+    m_planeLocs[2] = program.uniformLocation("videoVTex");
+    m_yuvLoc = program.uniformLocation("videoYuv");
+}
+
+void CVideoSampler::Bind(QOpenGLShaderProgram& program, const CVideoTexture* video, int firstUnit)
+{
+    for (int plane = 0; plane < 3; ++plane)
+    {
+        GL().glActiveTexture(GL_TEXTURE0 + firstUnit + plane);
+        GL().glBindTexture(GL_TEXTURE_2D, video->GetTextureID(plane));
+        program.setUniformValue(m_planeLocs[plane], firstUnit + plane);
+    }
+    program.setUniformValue(m_yuvLoc, video->GetTextureLayout() == LAYOUT_YUV420);
+}
+
+void CVideoSampler::Unbind(int firstUnit)
+{
+    for (int plane = 0; plane < 3; ++plane)
+    {
+        GL().glActiveTexture(GL_TEXTURE0 + firstUnit + plane);
+        GL().glBindTexture(GL_TEXTURE_2D, 0);
+    }
+}
+
 // ----------------------------------------------------------------------------
 // Base Effect: movie playback
 // ----------------------------------------------------------------------------
-CMoviePlayback::CMoviePlayback(): m_videoTex(nullptr), m_ffmpegLoc(-1)
+CMoviePlayback::CMoviePlayback(): m_videoTex(nullptr)
 {
 }
 
@@ -86,12 +146,11 @@ void CMoviePlayback::InitEffect(QObject* parent)
     QOpenGLShader *fshader = new QOpenGLShader(QOpenGLShader::Fragment, parent);
     const char *fsrc =
         "varying mediump vec2 texc;\n"
-        "uniform sampler2D videoTex;\n"
         "void main(void)\n"
         "{\n"
-        "    gl_FragColor = texture2D(videoTex, texc);\n"
+        "    gl_FragColor = videoColour(texc);\n"
         "}\n";
-    fshader->compileSourceCode(fsrc);
+    fshader->compileSourceCode(QByteArray(CVideoSampler::GetShaderSource()) + fsrc);
 
     m_program.setParent(parent);
     m_program.addShader(vshader);
@@ -99,7 +158,7 @@ void CMoviePlayback::InitEffect(QObject* parent)
     m_program.bindAttributeLocation("vertex", 0);
     m_program.link();
 
-    m_ffmpegLoc = m_program.uniformLocation("videoTex");
+    m_videoSampler.Init(m_program);
 }
 
 void CMoviePlayback::Enable()
@@ -129,9 +188,7 @@ void CMoviePlayback::DoRender()
     glViewport(0, 0, m_width, m_height);
     m_program.bind();
 
-    GL().glActiveTexture(GL_TEXTURE0);
-    GL().glBindTexture(GL_TEXTURE_2D, m_videoTex->GetTextureID());
-    m_program.setUniformValue(m_ffmpegLoc, 0);
+    m_videoSampler.Bind(m_program, m_videoTex, 0);
 
     GL().glBindFramebuffer(GL_FRAMEBUFFER, m_renderTarget);
 
@@ -139,8 +196,8 @@ void CMoviePlayback::DoRender()
     glEnableClientState(GL_VERTEX_ARRAY);
     GL().glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
+    m_videoSampler.Unbind(0);
     GL().glActiveTexture(GL_TEXTURE0);
-    GL().glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 // ----------------------------------------------------------------------------
@@ -149,7 +206,7 @@ void CMoviePlayback::DoRender()
 #include "Fractal.hpp"
 #include "FFmpegPlayer.hpp"
 
-CFractalFX::CFractalFX(): m_fractalLoc(-1), m_ffmpegLoc(-1), m_alphaLoc(-1),
+CFractalFX::CFractalFX(): m_fractalLoc(-1), m_alphaLoc(-1),
                           m_lookupLoc(-1), m_alpha(0.f),
                           m_videoTex(nullptr), m_fractalTex(nullptr), m_lookupTexId(0)
 {
@@ -170,7 +227,6 @@ void CFractalFX::InitEffect(QObject* parent)
     const char *fsrc =
         "varying mediump vec2 texc;\n"
         "uniform sampler2D fractalTex;\n"
-        "uniform sampler2D videoTex;\n"
         "uniform sampler2D lookupTex;\n"
         "uniform float alpha;\n"
         "void main(void)\n"
@@ -178,13 +234,13 @@ void CFractalFX::InitEffect(QObject* parent)
         "    vec4 fractColour = texture2D(fractalTex, texc);\n"
         "    float fractAlpha = fractColour.r * (1.0 - alpha);\n"
         "\n"
-        "    vec4 videoColour = texture2D(videoTex, texc);\n"
+        "    vec4 video = videoColour(texc);\n"
         "    vec4 lookupColour = texture2D(lookupTex, vec2(fractColour.x, 0.0));\n"
         "\n"
         "    gl_FragColor = lookupColour * fractAlpha +\n"
-        "                   videoColour * (1.0 - fractAlpha);\n"
+        "                   video * (1.0 - fractAlpha);\n"
         "}\n";
-    fshader->compileSourceCode(fsrc);
+    fshader->compileSourceCode(QByteArray(CVideoSampler::GetShaderSource()) + fsrc);
 
     m_program.setParent(parent);
     m_program.addShader(vshader);
@@ -193,7 +249,7 @@ void CFractalFX::InitEffect(QObject* parent)
     m_program.link();
 
     m_fractalLoc = m_program.uniformLocation("fractalTex");
-    m_ffmpegLoc = m_program.uniformLocation("videoTex");
+    m_videoSampler.Init(m_program);
     m_lookupLoc = m_program.uniformLocation("lookupTex");
     m_alphaLoc = m_program.uniformLocation("alpha");
 }
@@ -239,12 +295,10 @@ void CFractalFX::DoRender()
     m_program.setUniformValue(m_fractalLoc, 0);
 
     GL().glActiveTexture(GL_TEXTURE1);
-    GL().glBindTexture(GL_TEXTURE_2D, m_videoTex->GetTextureID());
-    m_program.setUniformValue(m_ffmpegLoc, 1);
-
-    GL().glActiveTexture(GL_TEXTURE2);
     GL().glBindTexture(GL_TEXTURE_2D, m_lookupTexId);
-    m_program.setUniformValue(m_lookupLoc, 2);
+    m_program.setUniformValue(m_lookupLoc, 1);
+
+    m_videoSampler.Bind(m_program, m_videoTex, 2);
 
     m_program.setUniformValue(m_alphaLoc, m_alpha);
 
@@ -254,6 +308,7 @@ void CFractalFX::DoRender()
     glEnableClientState(GL_VERTEX_ARRAY);
     GL().glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
+    m_videoSampler.Unbind(2);
     GL().glActiveTexture(GL_TEXTURE1);
     GL().glBindTexture(GL_TEXTURE_2D, 0);
     GL().glActiveTexture(GL_TEXTURE0);
@@ -33,6 +33,28 @@ protected:
 class CVideoTexture;
 class CFractalTexture;
 
+/**
+ * The video part of the shaders which show the video. Frames come either as
+ * BGRA or as Y, U and V planes, which videoColour() converts to RGB.
+ */
+class CVideoSampler
+{
+public:
+    // GLSL to put before the fragment shader
+    static const char* GetShaderSource();
+
+    CVideoSampler();
+    void Init(QOpenGLShaderProgram& program);
+    // Binds the planes to the texture units from @p firstUnit on, three
+    void Bind(QOpenGLShaderProgram& program, const CVideoTexture* video, int firstUnit);
+    void Unbind(int firstUnit);
+
+private:
+    // BGRA or Y, U, V
+    int m_planeLocs[3];
+    int m_yuvLoc;
+};
+
 class CMoviePlayback: public CEffect
 {
 public:
@@ -50,8 +72,7 @@ private:
     // for control framerate
     float m_time;
 
-    /* uniform of fragment shader */
-    int m_ffmpegLoc;
+    CVideoSampler m_videoSampler;
 };
 
 class CFractalFX: public CEffect
@@ -77,7 +98,7 @@ private:
 
     /* uniform of fragment shader */
     int m_fractalLoc;
-    int m_ffmpegLoc;
+    CVideoSampler m_videoSampler;
     int m_lookupLoc;
     int m_alphaLoc;
     float m_alpha;
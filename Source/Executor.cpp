@@ -0,0 +1,467 @@
+#include "Stdafx.hpp"
+#include "Executor.hpp"
+#include "ThreadPlacement.hpp"
+#include <QSemaphore>
+#include <QThread>
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+    // The video and the fractal each keep one frame job in flight. Below two
+    // threads a slow fractal frame would hold up the video.
+    const int kMinThreads = 2;
+    const qint64 kNever = std::numeric_limits<qint64>::max();
+
+    // Shared by the caller of RunParallel() and its helper jobs. A helper may
+    // only start once the caller is done, so it joins first and only then
+    // touches body.
+    struct SItemQueue
+    {
+        static const int kClosed = 1 << 30;
+
+        SItemQueue(int count, const std::function<void(int)>& func,
+                   const std::function<bool()>& stopCondition)
+            : next(0), itemCount(count), body(func), stopped(stopCondition), helpers(0)
+        {
+        }
+
+        bool Join()
+        {
+            int state = helpers;
+            while (! (state & kClosed))
+            {
+                if (helpers.compare_exchange_weak(state, state + 1))
+                    return true;
+            }
+            return false;
+        }
+
+        void Leave()
+        {
+            if (helpers.fetch_sub(1) == (kClosed | 1))
+                finished.release();
+        }
+
+        // Lets no more helpers in and waits for those still at work
+        void Close()
+        {
+            if (helpers.fetch_or(kClosed) != 0)
+                finished.acquire();
+        }
+
+        void Work()
+        {
+            while (! stopped())
+            {
+                const int item = next++;
+                if (item >= itemCount)
+                    break;
+
+                body(item);
+            }
+        }
+
+        std::atomic<int> next;
+        const int itemCount;
+        const std::function<void(int)>& body;
+        const std::function<bool()> stopped;
+        // number of helpers at work, or'ed with kClosed by the caller
+        std::atomic<int> helpers;
+        QSemaphore finished;
+    };
+}
+
+class CExecutor::CThread: public QThread
+{
+public:
+    CThread(CExecutor* executor, int index): m_executor(executor), m_index(index)
+    {
+    }
+
+    void run() override
+    {
+        m_executor->Run(m_index);
+    }
+
+private:
+    CExecutor* m_executor;
+    int m_index;
+};
+
+// -----------------------------------------------------------------------------
+// CExecutor Functions
+// -----------------------------------------------------------------------------
+CExecutor::SDeadlineQueue::SDeadlineQueue(): sequence(0)
+{
+}
+
+CExecutor CExecutor::s_instance;
+
+CExecutor::CExecutor(): m_nextDueMs(kNever), m_queued(0), m_idle(0), m_started(false),
+                        m_stop(false), m_executed(0), m_stolen(0), m_delayedCount(0)
+{
+    m_clock.start();
+}
+
+CExecutor::~CExecutor()
+{
+    Shutdown();
+}
+
+CExecutor& CExecutor::GetInstance()
+{
+    return s_instance;
+}
+
+void CExecutor::Start()
+{
+    QMutexLocker locker(&m_sleepMutex);
+    if (m_started || m_stop)
+    {
+        return;
+    }
+
+    // one thread per core of the budget the decoder threads left over
+    const int count = CThreadPlacement::GetInstance().TakeExecutorCores(kMinThreads);
+    for (int i = 0; i < count; ++i)
+    {
+        m_queues.push_back(std::unique_ptr<SQueue>(new SQueue));
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        m_threads.push_back(new CThread(this, i));
+    }
+    for (auto& thread : m_threads)
+    {
+        thread->start();
+    }
+    m_started = true;
+}
+
+void CExecutor::Shutdown()
+{
+    {
+        QMutexLocker locker(&m_sleepMutex);
+        m_stop = true;
+        m_wakeSignal.wakeAll();
+    }
+
+    for (auto& thread : m_threads)
+    {
+        thread->wait();
+        delete thread;
+    }
+    m_threads.clear();
+}
+
+void CExecutor::Submit(const Job& job)
+{
+    if (! m_started)
+    {
+        Start();
+    }
+
+    const int index = GetCurrentIndex();
+    if (index >= 0)
+    {
+        Push(*m_queues[index], job);
+    }
+    else
+    {
+        Post(job);
+    }
+}
+
+void CExecutor::Post(const Job& job, qint64 deadlineMs)
+{
+    if (! m_started)
+    {
+        Start();
+    }
+
+    {
+        QMutexLocker locker(&m_injected.mutex);
+        PushScheduled(job, deadlineMs);
+    }
+
+    m_queued++;
+    Wake();
+}
+
+void CExecutor::SubmitDelayed(const Job& job, int delayMs, qint64 deadlineMs)
+{
+    if (! m_started)
+    {
+        Start();
+    }
+
+    QMutexLocker locker(&m_sleepMutex);
+
+    const SDelayedJob delayed = { m_clock.elapsed() + delayMs, deadlineMs, job };
+    m_delayed.push_back(delayed);
+    m_delayedCount++;
+
+    if (delayed.dueMs < m_nextDueMs)
+    {
+        m_nextDueMs = delayed.dueMs;
+        // a sleeping thread has to wake up earlier now
+        m_wakeSignal.wakeOne();
+    }
+}
+
+void CExecutor::RunParallel(int count, const std::function<void(int)>& body,
+                            const std::function<bool()>& stopped)
+{
+    std::shared_ptr<SItemQueue> queue = std::make_shared<SItemQueue>(count, body, stopped);
+
+    // Only ask for as many helpers as there are idle executor threads. The
+    // calling thread works on the queue as well and doesn't wait for
+    // helpers which haven't started when it is done.
+    const int helpers = std::min(count - 1, GetIdleThreadCount());
+    for (int i = 0; i < helpers; ++i)
+    {
+        Submit([queue]()
+        {
+            if (queue->Join())
+            {
+                queue->Work();
+                queue->Leave();
+            }
+        });
+    }
+
+    queue->Work();
+    queue->Close();
+}
+
+qint64 CExecutor::GetTimeMs() const
+{
+    return m_clock.elapsed();
+}
+
+int CExecutor::GetThreadCount() const
+{
+    return static_cast<int>(m_threads.size());
+}
+
+int CExecutor::GetIdleThreadCount() const
+{
+    return m_idle;
+}
+
+SExecutorStats CExecutor::GetStats() const
+{
+    SExecutorStats stats;
+    stats.threads = GetThreadCount();
+    stats.executed = m_executed;
+    stats.stolen = m_stolen;
+    stats.delayed = m_delayedCount;
+    return stats;
+}
+
+void CExecutor::Run(int index)
+{
+    CThreadPlacement& placement = CThreadPlacement::GetInstance();
+    const int placementId =
+        placement.PlaceCurrentThread(ROLE_EXECUTOR, QString("executor %1").arg(index));
+
+    forever
+    {
+        // busy threads look after the delayed jobs as well
+        if (m_nextDueMs <= m_clock.elapsed())
+        {
+            QMutexLocker locker(&m_sleepMutex);
+            ReleaseDueJobs();
+        }
+
+        Job job;
+        if (TakeJob(index, job))
+        {
+            job();
+            m_executed++;
+            placement.SampleThread(placementId);
+            continue;
+        }
+
+        QMutexLocker locker(&m_sleepMutex);
+        if (m_stop)
+        {
+            break;
+        }
+
+        ReleaseDueJobs();
+
+        // Submit() only wakes a thread if it sees it idle, so count
+        // ourselves before the last look at the queues
+        m_idle++;
+        if (m_queued == 0)
+        {
+            const qint64 dueMs = m_nextDueMs;
+            if (dueMs == kNever)
+            {
+                m_wakeSignal.wait(&m_sleepMutex);
+            }
+            else
+            {
+                const qint64 waitMs = std::max<qint64>(1, dueMs - m_clock.elapsed());
+                m_wakeSignal.wait(&m_sleepMutex, static_cast<unsigned long>(waitMs));
+            }
+        }
+        m_idle--;
+    }
+}
+
+bool CExecutor::TakeJob(int index, Job& job)
+{
+    if (m_queued == 0)
+    {
+        return false;
+    }
+
+    // The newest own job first, its data is most likely still in the cache.
+    // Those are tiles of a frame in progress, so they go before other frames.
+    if (TakeBack(*m_queues[index], job) || TakeEarliest(job))
+    {
+        m_queued--;
+        return true;
+    }
+
+    // then the oldest job of another thread
+    const int count = static_cast<int>(m_queues.size());
+    for (int i = 1; i < count; ++i)
+    {
+        if (TakeFront(*m_queues[(index + i) % count], job))
+        {
+            m_queued--;
+            m_stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CExecutor::TakeFront(SQueue& queue, Job& job)
+{
+    QMutexLocker locker(&queue.mutex);
+    if (queue.jobs.empty())
+    {
+        return false;
+    }
+
+    job = std::move(queue.jobs.front());
+    queue.jobs.pop_front();
+    return true;
+}
+
+bool CExecutor::TakeBack(SQueue& queue, Job& job)
+{
+    QMutexLocker locker(&queue.mutex);
+    if (queue.jobs.empty())
+    {
+        return false;
+    }
+
+    job = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    return true;
+}
+
+bool CExecutor::TakeEarliest(Job& job)
+{
+    QMutexLocker locker(&m_injected.mutex);
+    if (m_injected.jobs.empty())
+    {
+        return false;
+    }
+
+    std::pop_heap(m_injected.jobs.begin(), m_injected.jobs.end(), &CExecutor::IsLater);
+    job = std::move(m_injected.jobs.back().job);
+    m_injected.jobs.pop_back();
+    return true;
+}
+
+bool CExecutor::IsLater(const SScheduledJob& a, const SScheduledJob& b)
+{
+    if (a.deadlineMs != b.deadlineMs)
+        return a.deadlineMs > b.deadlineMs;
+    return a.sequence > b.sequence;
+}
+
+int CExecutor::GetCurrentIndex() const
+{
+    const QThread* current = QThread::currentThread();
+    for (size_t i = 0; i < m_threads.size(); ++i)
+    {
+        if (m_threads[i] == current)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+void CExecutor::Push(SQueue& queue, const Job& job)
+{
+    {
+        QMutexLocker locker(&queue.mutex);
+        queue.jobs.push_back(job);
+    }
+
+    m_queued++;
+    Wake();
+}
+
+void CExecutor::PushScheduled(const Job& job, qint64 deadlineMs)
+{
+    const SScheduledJob scheduled = { deadlineMs, m_injected.sequence++, job };
+    m_injected.jobs.push_back(scheduled);
+    std::push_heap(m_injected.jobs.begin(), m_injected.jobs.end(), &CExecutor::IsLater);
+}
+
+void CExecutor::Wake()
+{
+    if (m_idle > 0)
+    {
+        QMutexLocker locker(&m_sleepMutex);
+        m_wakeSignal.wakeOne();
+    }
+}
+
+void CExecutor::ReleaseDueJobs()
+{
+    const qint64 nowMs = m_clock.elapsed();
+    if (m_nextDueMs > nowMs)
+    {
+        return;
+    }
+
+    int released = 0;
+    qint64 nextDueMs = kNever;
+    {
+        QMutexLocker locker(&m_injected.mutex);
+        for (size_t i = 0; i < m_delayed.size();)
+        {
+            if (m_delayed[i].dueMs <= nowMs)
+            {
+                PushScheduled(m_delayed[i].job, m_delayed[i].deadlineMs);
+                if (i + 1 != m_delayed.size())
+                    m_delayed[i] = std::move(m_delayed.back());
+                m_delayed.pop_back();
+                ++released;
+            }
+            else
+            {
+                nextDueMs = std::min(nextDueMs, m_delayed[i].dueMs);
+                ++i;
+            }
+        }
+    }
+
+    m_nextDueMs = nextDueMs;
+    m_queued += released;
+
+    // the calling thread takes one of them itself
+    for (int i = 1; i < released; ++i)
+    {
+        m_wakeSignal.wakeOne();
+    }
+}
@@ -0,0 +1,150 @@
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// One set of threads, sized to the machine, for all producers. Texture
+// objects submit their frames as jobs and frames submit their tiles. Every
+// thread has its own queue and an idle thread steals from the others.
+// Posted frame jobs run earliest deadline first.
+// ----------------------------------------------------------------------------
+
+typedef std::function<void()> Job;
+
+// Deadline of jobs which have none, they run after all others
+const qint64 kNoDeadline = 0x7FFFFFFFFFFFFFFFLL;
+
+struct SExecutorStats
+{
+    int threads;
+    unsigned long long executed;
+    // taken from the queue of another executor thread
+    unsigned long long stolen;
+    unsigned long long delayed;
+};
+
+class CExecutor
+{
+public:
+    static CExecutor& GetInstance();
+
+    /**
+     * Runs @p job on one of the executor threads. Submitted by one of them
+     * it goes to that thread's own queue, where it runs next unless an idle
+     * thread steals it first.
+     */
+    void Submit(const Job& job);
+    /**
+     * Queues @p job behind all waiting jobs with an earlier or the same
+     * deadline, whichever thread submits it. For jobs which submit
+     * themselves again and mustn't take turns ahead of the others.
+     * @param deadlineMs In GetTimeMs() time.
+     */
+    void Post(const Job& job, qint64 deadlineMs = kNoDeadline);
+    // Post()s @p job, not before delayMs from now
+    void SubmitDelayed(const Job& job, int delayMs, qint64 deadlineMs = kNoDeadline);
+    /**
+     * Runs body(item) for item in [0, count) on the calling thread and on
+     * the idle executor threads, handing items out one at a time. Returns
+     * once all started items are done, items not started yet are left out
+     * when @p stopped returns true.
+     */
+    void RunParallel(int count, const std::function<void(int)>& body,
+                     const std::function<bool()>& stopped);
+    // Time base of the deadlines
+    qint64 GetTimeMs() const;
+    int GetThreadCount() const;
+    // Threads waiting for work right now
+    int GetIdleThreadCount() const;
+    SExecutorStats GetStats() const;
+    // Lets the threads finish their current job and waits for them
+    void Shutdown();
+
+private:
+    CExecutor();
+    ~CExecutor();
+    CExecutor(const CExecutor&) = delete;
+    CExecutor& operator=(const CExecutor&) = delete;
+
+    struct SQueue
+    {
+        QMutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    struct SScheduledJob
+    {
+        qint64 deadlineMs;
+        // keeps jobs of the same deadline in order
+        unsigned long long sequence;
+        Job job;
+    };
+
+    // Ordered by deadline, earliest at the top of the heap
+    struct SDeadlineQueue
+    {
+        SDeadlineQueue();
+
+        QMutex mutex;
+        std::vector<SScheduledJob> jobs;
+        unsigned long long sequence;
+    };
+
+    struct SDelayedJob
+    {
+        qint64 dueMs;
+        qint64 deadlineMs;
+        Job job;
+    };
+
+    class CThread;
+
+    void Start();
+    void Run(int index);
+    bool TakeJob(int index, Job& job);
+    bool TakeFront(SQueue& queue, Job& job);
+    bool TakeBack(SQueue& queue, Job& job);
+    bool TakeEarliest(Job& job);
+    // Heap order of m_injected
+    static bool IsLater(const SScheduledJob& a, const SScheduledJob& b);
+    // -1 if the calling thread is not an executor thread
+    int GetCurrentIndex() const;
+    void Push(SQueue& queue, const Job& job);
+    // m_injected.mutex must be locked
+    void PushScheduled(const Job& job, qint64 deadlineMs);
+    void Wake();
+    // Moves the delayed jobs which are due to m_injected, m_sleepMutex
+    // must be locked
+    void ReleaseDueJobs();
+
+    static CExecutor s_instance;
+
+    std::vector<CThread*> m_threads;
+    std::vector<std::unique_ptr<SQueue>> m_queues;
+    // jobs from threads outside the executor, posted and delayed jobs
+    SDeadlineQueue m_injected;
+
+    mutable QMutex m_sleepMutex;
+    QWaitCondition m_wakeSignal;
+    std::vector<SDelayedJob> m_delayed;
+    QElapsedTimer m_clock;
+    std::atomic<qint64> m_nextDueMs;
+    std::atomic<int> m_queued;
+    std::atomic<int> m_idle;
+    std::atomic<bool> m_started;
+    bool m_stop;
+
+    std::atomic<unsigned long long> m_executed;
+    std::atomic<unsigned long long> m_stolen;
+    std::atomic<unsigned long long> m_delayedCount;
+};
+
+#endif // EXECUTOR_HPP
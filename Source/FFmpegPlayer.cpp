@@ -3,15 +3,25 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <functional>
+#include <iomanip>
+#include <ostream>
 #include <stdexcept>
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QThread>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/pixdesc.h>
 #include <libswscale/swscale.h>
 }
 
 #include "Buffer.hpp"
+#include "CancelToken.hpp"
+#include "Executor.hpp"
+#include "SpscQueue.hpp"
 
 namespace {
 
@@ -23,14 +33,46 @@ namespace {
 \
         memset(buffer.data(), 0, buffer.size());    \
 \
-        int ret = av_strerror(m_videoStream, buffer.data(), buffer.size());   \
+        int ret = av_strerror(ERROR_CODE, buffer.data(), buffer.size());   \
 \
 		std::string str = FUNCTION_NAME;	\
+		str += ": ";	\
 		str += ret == 0 ? buffer.data() : "unknown error";	\
 		throw std::runtime_error(str);   \
     }   \
 } while (false)
 
+// Rows per sws_scale() call, a multiple of the chroma subsampling. One slice
+// is the longest a cancel waits for the conversion.
+const int kScaleSliceRows = 32;
+
+// Output rows of a band at least, below that a band isn't worth a job
+const int kMinBandRows = 64;
+
+// Conversions of one frame per benchmark run
+const int kBenchmarkConversions = 60;
+
+// Packets the demuxer may read ahead, a few seconds of the movie
+const int kPacketQueueSize = 64;
+// Decoded frames the decode stage may run ahead of the conversion
+const int kDecodedFrames = 4;
+
+// AVCodecContext::thread_type in the order of DECODE_THREADING
+const int kThreadTypes[] = { 0, FF_THREAD_FRAME, FF_THREAD_SLICE, FF_THREAD_FRAME | FF_THREAD_SLICE };
+
+// Frames decoded per benchmark run, less if the movie is shorter
+const int kBenchmarkFrames = 240;
+
+// H.264 pixels one decoder thread decodes per second. The D benchmark gave
+// 140 to 180 million on one core, from 334 fps of 480p to 21 fps of 2160p.
+const long long kDecodePixelsPerSecond = 140000000;
+// Frame rate the decoder threads are sized for, 60 fps with half of each
+// core to spare
+const int kDecodeSizingFps = 2 * 60;
+// The decoder takes at most this share of the core budget, the executor
+// keeps the rest for the conversion and the fractal
+const int kDecodeBudgetDivisor = 2;
+
 void free_av_frame(AVFrame* frame)
 {
     avcodec_free_frame(&frame);
@@ -41,12 +83,137 @@ void close_av_input(AVFormatContext* context)
     avformat_close_input(&context);
 }
 
+// Rounds @p row down to a multiple of @p align, a power of two
+int align_row(int row, int align)
+{
+    return row & ~(align - 1);
+}
+
+// Decoder threads for frames of @p width x @p height out of @p budget
+// cores, at least one
+int decode_threads_for(int width, int height, int budget)
+{
+    const long long pixelsPerSecond = static_cast<long long>(width) * height * kDecodeSizingFps;
+    const int wanted = static_cast<int>((pixelsPerSecond + kDecodePixelsPerSecond - 1) /
+                                        kDecodePixelsPerSecond);
+    return std::max(1, std::min(wanted, budget / kDecodeBudgetDivisor));
+}
+
+// Vertical chroma subsampling of @p plane, as a shift of the rows
+int plane_row_shift(int plane, int chromaShift)
+{
+    return plane == 1 || plane == 2 ? chromaShift : 0;
 }
 
-CFFmpegPlayer::CFFmpegPlayer(const std::string& fileName): m_formatCtx(nullptr, close_av_input),
+// Takes one of @p semaphore, adds the time it had to wait to @p waitedUs
+void acquire_timed(QSemaphore& semaphore, std::atomic<unsigned long long>& waitedUs)
+{
+    if (semaphore.tryAcquire())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    semaphore.acquire();
+    waitedUs += timer.nsecsElapsed() / 1000;
+}
+
+class CStageThread: public QThread
+{
+public:
+    explicit CStageThread(const std::function<void()>& stage): m_stage(stage)
+    {
+    }
+
+    void run() override
+    {
+        m_stage();
+    }
+
+private:
+    std::function<void()> m_stage;
+};
+
+}
+
+// A frame of the pool the decode stage copies decoded frames into. This
+// FFmpeg has no reference counted frames, the decoder reuses its own.
+struct CFFmpegPlayer::SDecodedFrame
+{
+    AVPicture picture;
+    unsigned int pts;
+    // marks the end of the movie, has no picture data
+    bool end;
+};
+
+struct CFFmpegPlayer::SPipeline
+{
+    SPipeline(): packets(kPacketQueueSize), decoded(kDecodedFrames), free(kDecodedFrames),
+                 frames(kDecodedFrames), packetRoom(kPacketQueueSize), stop(false), error(0),
+                 failed(false), held(nullptr), starving(false), packetFill(0), packetPops(0),
+                 frameFill(0),
+                 framePops(0), demuxBlockedUs(0), decodeBlockedUs(0), decodeStarvedUs(0),
+                 convertStarvedUs(0)
+    {
+        memset(frames.data(), 0, frames.size() * sizeof(SDecodedFrame));
+    }
+
+    ~SPipeline()
+    {
+        for (auto& frame : frames)
+        {
+            avpicture_free(&frame.picture);
+        }
+    }
+
+    // demux -> decode, a packet without data marks the end of the movie
+    CSpscQueue<AVPacket> packets;
+    // decode -> convert
+    CSpscQueue<SDecodedFrame*> decoded;
+    // convert -> decode, frames of the pool to decode into
+    CSpscQueue<SDecodedFrame*> free;
+    std::vector<SDecodedFrame> frames;
+
+    // The queues move the items without a lock. A stage which finds its
+    // queue full or empty sleeps on one of these until the other side has
+    // popped or pushed, each push or pop releases one.
+    QSemaphore packetRoom;
+    QSemaphore packetsQueued;
+    QSemaphore framesQueued;
+    QSemaphore framesFree;
+
+    std::unique_ptr<QThread> demuxThread;
+    std::unique_ptr<QThread> decodeThread;
+    std::atomic<bool> stop;
+    // first error of a stage, the stage has ended
+    std::atomic<int> error;
+    // set by the decode stage as it ends after an error, once every frame
+    // decoded before is queued
+    std::atomic<bool> failed;
+
+    // only touched by the converting side
+    // taken, but its conversion was cancelled, decodeFrame() converts it
+    // again before it takes the next one
+    SDecodedFrame* held;
+    bool starving;
+    QElapsedTimer starvingTimer;
+
+    std::atomic<unsigned long long> packetFill;
+    std::atomic<unsigned long long> packetPops;
+    std::atomic<unsigned long long> frameFill;
+    std::atomic<unsigned long long> framePops;
+    std::atomic<unsigned long long> demuxBlockedUs;
+    std::atomic<unsigned long long> decodeBlockedUs;
+    std::atomic<unsigned long long> decodeStarvedUs;
+    std::atomic<unsigned long long> convertStarvedUs;
+};
+
+CFFmpegPlayer::CFFmpegPlayer(const std::string& fileName, DECODE_THREADING threading, int threads):
+                                                           m_formatCtx(nullptr, close_av_input),
 														   m_codecCtx(nullptr, avcodec_close),
 														   m_frame(avcodec_alloc_frame(), free_av_frame),
-														   m_swsCtx(nullptr), m_videoStream(-1)
+														   m_videoStream(-1), m_convertedFrames(0),
+														   m_convertUs(0), m_lastConvertUs(0),
+														   m_convertSlices(0)
 {
     AVDictionary* optionsDict = nullptr;
     AVFormatContext* format = nullptr;
@@ -65,88 +232,636 @@ CFFmpegPlayer::CFFmpegPlayer(const std::string& fileName): m_formatCtx(nullptr,
 
     m_videoStream = av_find_best_stream(m_formatCtx.get(), AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
 
-    CHECK_FFMPEG_RETURN_CODE(error, "av_find_best_stream");
+    CHECK_FFMPEG_RETURN_CODE(m_videoStream, "av_find_best_stream");
 
     assert(m_videoStream >= 0);
 
     m_codecCtx.reset(m_formatCtx->streams[m_videoStream]->codec);
 
     m_codecCtx->flags2 = 0;//CODEC_FLAG2_FAST;
-    m_codecCtx->thread_count = 1;
-    m_codecCtx->thread_type = 0;
 
-    error = avcodec_open2(m_codecCtx.get(), codec, &optionsDict);
+    // The decode thread waits for the decoder threads, so it lends them its
+    // own core. A small movie needs few of them, the executor gets the rest.
+    if (threading != DECODE_SINGLE && threads == 0)
+    {
+        const int wanted = decode_threads_for(m_codecCtx->width, m_codecCtx->height,
+                                              CThreadPlacement::GetInstance().GetCoreBudget());
+        m_cores.reset(new CCoreReservation(wanted - 1));
+        threads = 1 + m_cores->GetCores();
+    }
+    m_codecCtx->thread_count = threading == DECODE_SINGLE ? 1 : std::max(threads, 1);
+    m_codecCtx->thread_type = kThreadTypes[threading];
+
+    {
+        // the decoder threads start in here
+        CPlacementScope scope(ROLE_EXECUTOR);
+        error = avcodec_open2(m_codecCtx.get(), codec, &optionsDict);
+    }
 
     CHECK_FFMPEG_RETURN_CODE(error, "avcodec_open2");
 
     m_outputWidth = 0;
     m_outputHeight = 0;
-    m_pixelSize = 0;
+    m_outputLayout = LAYOUT_PACKED;
+    m_maxSlices = CThreadPlacement::GetInstance().GetCoreBudget();
     setOutputSize(m_codecCtx->width, m_codecCtx->height);
+
+    m_pipeline.reset(new SPipeline);
+    for (auto& frame : m_pipeline->frames)
+    {
+        error = avpicture_alloc(&frame.picture, m_codecCtx->pix_fmt,
+                                m_codecCtx->width, m_codecCtx->height);
+
+        CHECK_FFMPEG_RETURN_CODE(error, "avpicture_alloc");
+
+        m_pipeline->free.TryPush(&frame);
+        m_pipeline->framesFree.release();
+    }
+
+    m_pipeline->demuxThread.reset(new CStageThread([this]() { demux(); }));
+    m_pipeline->decodeThread.reset(new CStageThread([this]() { decode(); }));
+    {
+        // untracked, the stages come and go with the movie
+        CPlacementScope scope(ROLE_EXECUTOR);
+        m_pipeline->demuxThread->start();
+        m_pipeline->decodeThread->start();
+    }
 }
 
 CFFmpegPlayer::~CFFmpegPlayer()
 {
+    stopPipeline();
+    freeBands();
 }
 
-void CFFmpegPlayer::setOutputSize(int width, int height) {
-    if (m_outputWidth == width && m_outputHeight == height)
+void CFFmpegPlayer::setOutputSize(int width, int height, FRAME_LAYOUT layout) {
+    if (m_outputWidth == width && m_outputHeight == height && m_outputLayout == layout)
         return;
     m_outputWidth = width;
     m_outputHeight = height;
-    m_swsCtx = sws_getCachedContext(
-        m_swsCtx, m_codecCtx->width, m_codecCtx->height,
-        m_codecCtx->pix_fmt, width, height,
-        AV_PIX_FMT_BGRA, SWS_POINT, nullptr, nullptr, nullptr);
-    m_pixelSize = GetGLPixelSize(GL_BGRA);
+    m_outputLayout = layout;
+    createBands();
+}
+
+void CFFmpegPlayer::setConvertSlices(int slices)
+{
+    if (m_maxSlices == std::max(slices, 1))
+        return;
+    m_maxSlices = std::max(slices, 1);
+    createBands();
+}
+
+SPipelineStats CFFmpegPlayer::getPipelineStats() const
+{
+    const SPipeline& pipeline = *m_pipeline;
+    SPipelineStats stats;
+    stats.packets = pipeline.packets.GetSize();
+    stats.packetCapacity = pipeline.packets.GetCapacity();
+    stats.frames = pipeline.decoded.GetSize();
+    stats.frameCapacity = pipeline.decoded.GetCapacity();
+    stats.meanPackets = static_cast<double>(pipeline.packetFill) /
+                        std::max<unsigned long long>(pipeline.packetPops, 1);
+    stats.meanFrames = static_cast<double>(pipeline.frameFill) /
+                       std::max<unsigned long long>(pipeline.framePops, 1);
+    stats.demuxBlockedMs = pipeline.demuxBlockedUs / 1000;
+    stats.decodeBlockedMs = pipeline.decodeBlockedUs / 1000;
+    stats.decodeStarvedMs = pipeline.decodeStarvedUs / 1000;
+    stats.convertStarvedMs = pipeline.convertStarvedUs / 1000;
+    return stats;
+}
+
+SConvertStats CFFmpegPlayer::getConvertStats() const
+{
+    SConvertStats stats;
+    stats.frames = m_convertedFrames;
+    stats.totalUs = m_convertUs;
+    stats.lastUs = m_lastConvertUs;
+    stats.slices = m_convertSlices;
+    return stats;
+}
+
+void CFFmpegPlayer::createBands()
+{
+    freeBands();
+
+    const int sourceHeight = m_codecCtx->height;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(m_codecCtx->pix_fmt);
+    const int sourceAlign = desc ? 1 << desc->log2_chroma_h : 1;
+    const int outputAlign = m_outputLayout == LAYOUT_YUV420 ? 2 : 1;
+
+    int count = std::min(m_maxSlices, std::min(m_outputHeight, sourceHeight) / kMinBandRows);
+    // the palette of paletted frames isn't split up
+    if (! desc || (desc->flags & (PIX_FMT_PAL | PIX_FMT_PSEUDOPAL)))
+        count = 1;
+    count = std::max(count, 1);
+
+    // Each band scales on its own, so an edge row of a band only sees the
+    // source rows of its band. With SWS_POINT that makes no difference.
+    for (int i = 0; i < count; ++i)
+    {
+        const int outputY = align_row(static_cast<int>(
+            static_cast<long long>(m_outputHeight) * i / count), outputAlign);
+        const int outputEnd = i + 1 == count ? m_outputHeight : align_row(static_cast<int>(
+            static_cast<long long>(m_outputHeight) * (i + 1) / count), outputAlign);
+        const int sourceY = align_row(static_cast<int>(
+            static_cast<long long>(sourceHeight) * outputY / m_outputHeight), sourceAlign);
+        const int sourceEnd = i + 1 == count ? sourceHeight : align_row(static_cast<int>(
+            static_cast<long long>(sourceHeight) * outputEnd / m_outputHeight), sourceAlign);
+
+        // From a 4:2:0 stream of the same size the planes are only copied,
+        // the shader converts the colours
+        SConvertBand band;
+        band.context = sws_getContext(
+            m_codecCtx->width, sourceEnd - sourceY, m_codecCtx->pix_fmt,
+            m_outputWidth, outputEnd - outputY,
+            m_outputLayout == LAYOUT_YUV420 ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_BGRA,
+            SWS_POINT, nullptr, nullptr, nullptr);
+        if (! band.context)
+        {
+            freeBands();
+            throw std::runtime_error("sws_getContext failed");
+        }
+        band.sourceY = sourceY;
+        band.sourceRows = sourceEnd - sourceY;
+        band.outputY = outputY;
+        m_bands.push_back(band);
+    }
+    m_convertSlices = count;
+}
+
+void CFFmpegPlayer::freeBands()
+{
+    for (auto& band : m_bands)
+    {
+        sws_freeContext(band.context);
+    }
+    m_bands.clear();
 }
 
 int CFFmpegPlayer::getOutputSize() const
 {
-    return m_outputWidth * m_outputHeight * m_pixelSize;
+    if (m_outputLayout == LAYOUT_YUV420)
+    {
+        const int chroma = (m_outputWidth + 1) / 2 * ((m_outputHeight + 1) / 2);
+        return m_outputWidth * m_outputHeight + 2 * chroma;
+    }
+    return m_outputWidth * m_outputHeight * GetGLPixelSize(GL_BGRA);
+}
+
+void CFFmpegPlayer::getSourceSize(int& width, int& height) const
+{
+    width = m_codecCtx->width;
+    height = m_codecCtx->height;
 }
 
-bool CFFmpegPlayer::decodeFrame(unsigned int& pts, unsigned char* data, int lineSize)
+int CFFmpegPlayer::getThreadCount() const
 {
-    AVPacket packet;
-    int frameFinished = 0;
+    return m_codecCtx->active_thread_type ? m_codecCtx->thread_count : 1;
+}
 
-    if (av_read_frame(m_formatCtx.get(), &packet) >= 0)
-	{
-        if (packet.stream_index == m_videoStream)
-		{
-            int error = avcodec_decode_video2(m_codecCtx.get(), m_frame.get(), &frameFinished, &packet);
+bool CFFmpegPlayer::frameReady()
+{
+    SPipeline& pipeline = *m_pipeline;
+    if (pipeline.held || pipeline.decoded.GetSize() > 0)
+    {
+        return true;
+    }
 
-			CHECK_FFMPEG_RETURN_CODE(error, "avcodec_decode_video2");
+    // every frame decoded before the error is taken
+    if (pipeline.failed)
+    {
+        CHECK_FFMPEG_RETURN_CODE(pipeline.error, "video pipeline");
+    }
 
-            if (frameFinished)
-			{
-                error = sws_scale(m_swsCtx, (unsigned char const * const *)m_frame->data, m_frame->linesize,
-                                  0, m_codecCtx->height, &data, &lineSize);
+    // the conversion waits from now on until takeDecodedFrame()
+    if (! pipeline.starving)
+    {
+        pipeline.starving = true;
+        pipeline.starvingTimer.start();
+    }
+    return false;
+}
 
-				CHECK_FFMPEG_RETURN_CODE(error, "sws_scale");
+bool CFFmpegPlayer::decodeFrame(unsigned int& pts, unsigned char* const* planes,
+                                const int* lineSizes, const CCancelToken* cancel)
+{
+    SPipeline& pipeline = *m_pipeline;
+    SDecodedFrame* frame = pipeline.held ? pipeline.held : takeDecodedFrame();
+    pipeline.held = nullptr;
+
+    const bool newFrame = ! frame->end;
+    if (newFrame)
+    {
+        // a failed scaler setup leaves the frame to the decode stage too
+        try
+        {
+            convertFrame(*frame, planes, lineSizes, cancel);
+        }
+        catch (...)
+        {
+            pipeline.free.TryPush(frame);
+            pipeline.framesFree.release();
+            throw;
+        }
+        pts = frame->pts;
+
+        // the decode stage can't make it again, it stays for the next call
+        if (planes && cancel && cancel->IsCancelled())
+        {
+            pipeline.held = frame;
+            return true;
+        }
+    }
 
-                pts = av_q2d(m_formatCtx->streams[m_videoStream]->time_base) * m_frame->pts * 1000.0;
+    // back to the decode stage, the queue has room for the whole pool
+    pipeline.free.TryPush(frame);
+    pipeline.framesFree.release();
+    return newFrame;
+}
 
+void CFFmpegPlayer::demux()
+{
+    SPipeline& pipeline = *m_pipeline;
+
+    while (! pipeline.stop)
+    {
+        AVPacket packet;
+        int error = av_read_frame(m_formatCtx.get(), &packet);
+        if (error >= 0)
+        {
+            if (packet.stream_index != m_videoStream)
+            {
                 av_free_packet(&packet);
+                continue;
+            }
 
-				return true;
+            // the data may belong to the demuxer until the next read
+            error = av_dup_packet(&packet);
+            if (error < 0)
+            {
+                av_free_packet(&packet);
             }
         }
+        else
+        {
+            // set the movie to the start again, the decoder sees the end
+            // first
+            error = av_seek_frame(m_formatCtx.get(), m_videoStream, 0, AVSEEK_FLAG_FRAME);
+
+            av_init_packet(&packet);
+            packet.data = nullptr;
+            packet.size = 0;
+        }
+
+        if (error < 0)
+        {
+            // the decode stage finds no packet after the queued ones
+            pipeline.error = error;
+            pipeline.packetsQueued.release();
+            return;
+        }
+
+        acquire_timed(pipeline.packetRoom, pipeline.demuxBlockedUs);
+        if (pipeline.stop)
+        {
+            av_free_packet(&packet);
+            return;
+        }
+
+        pipeline.packets.TryPush(packet);
+        pipeline.packetsQueued.release();
+    }
+}
+
+void CFFmpegPlayer::decode()
+{
+    SPipeline& pipeline = *m_pipeline;
+
+    while (! pipeline.stop)
+    {
+        acquire_timed(pipeline.packetsQueued, pipeline.decodeStarvedUs);
+
+        AVPacket packet;
+        if (! pipeline.packets.TryPop(packet))
+        {
+            // stopped, or the demux stage failed
+            break;
+        }
+        pipeline.packetRoom.release();
+        pipeline.packetFill += pipeline.packets.GetSize();
+        pipeline.packetPops++;
+
+        const bool end = packet.data == nullptr;
+        const bool decoding = decodePacket(packet);
         av_free_packet(&packet);
+        if (! decoding)
+        {
+            break;
+        }
+
+        if (end)
+        {
+            SDecodedFrame* frame = takeFreeFrame();
+            if (frame == nullptr)
+            {
+                break;
+            }
+            frame->end = true;
+            pipeline.decoded.TryPush(frame);
+            pipeline.framesQueued.release();
+
+            avcodec_flush_buffers(m_codecCtx.get());
+        }
     }
-	else
-	{
-        // set the movie to the start again
-        int error = av_seek_frame(m_formatCtx.get(), m_videoStream, 0,  AVSEEK_FLAG_FRAME);
 
-		CHECK_FFMPEG_RETURN_CODE(error, "av_seek_frame");
+    if (pipeline.error < 0)
+    {
+        pipeline.failed = true;
+        pipeline.framesQueued.release();
     }
+}
 
-    return false;
+bool CFFmpegPlayer::decodePacket(AVPacket& packet)
+{
+    SPipeline& pipeline = *m_pipeline;
+    const double msPerPts = av_q2d(m_formatCtx->streams[m_videoStream]->time_base) * 1000.0;
+
+    // Frame threads still hold the last frames at the end, empty packets
+    // get them out one at a time
+    int frameFinished = 1;
+    while (frameFinished)
+    {
+        frameFinished = 0;
+        const int error = avcodec_decode_video2(m_codecCtx.get(), m_frame.get(), &frameFinished, &packet);
+        if (error < 0)
+        {
+            pipeline.error = error;
+            return false;
+        }
+
+        if (frameFinished)
+        {
+            SDecodedFrame* frame = takeFreeFrame();
+            if (frame == nullptr)
+            {
+                return false;
+            }
+
+            av_picture_copy(&frame->picture, reinterpret_cast<const AVPicture*>(m_frame.get()),
+                            m_codecCtx->pix_fmt, m_codecCtx->width, m_codecCtx->height);
+            frame->pts = static_cast<unsigned int>(msPerPts * m_frame->pts);
+            frame->end = false;
+            pipeline.decoded.TryPush(frame);
+            pipeline.framesQueued.release();
+        }
+
+        if (packet.data != nullptr)
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+CFFmpegPlayer::SDecodedFrame* CFFmpegPlayer::takeFreeFrame()
+{
+    SPipeline& pipeline = *m_pipeline;
+
+    // all frames of the pool queued is the backpressure of the conversion
+    acquire_timed(pipeline.framesFree, pipeline.decodeBlockedUs);
+
+    SDecodedFrame* frame = nullptr;
+    if (pipeline.stop || ! pipeline.free.TryPop(frame))
+    {
+        return nullptr;
+    }
+    return frame;
+}
+
+CFFmpegPlayer::SDecodedFrame* CFFmpegPlayer::takeDecodedFrame()
+{
+    SPipeline& pipeline = *m_pipeline;
+    acquire_timed(pipeline.framesQueued, pipeline.convertStarvedUs);
+
+    SDecodedFrame* frame = nullptr;
+    if (! pipeline.decoded.TryPop(frame))
+    {
+        // woken by the decode stage as it failed
+        pipeline.framesQueued.release();
+        CHECK_FFMPEG_RETURN_CODE(pipeline.error, "video pipeline");
+    }
+
+    // the wait since frameReady() said no
+    if (pipeline.starving)
+    {
+        pipeline.starving = false;
+        pipeline.convertStarvedUs += pipeline.starvingTimer.nsecsElapsed() / 1000;
+    }
+    pipeline.frameFill += pipeline.decoded.GetSize();
+    pipeline.framePops++;
+    return frame;
+}
+
+void CFFmpegPlayer::stopPipeline()
+{
+    if (m_pipeline == nullptr)
+    {
+        return;
+    }
+
+    // wakes a stage which waits on a queue, there is one waiter at most
+    m_pipeline->stop = true;
+    m_pipeline->packetRoom.release();
+    m_pipeline->packetsQueued.release();
+    m_pipeline->framesFree.release();
+    m_pipeline->demuxThread->wait();
+    m_pipeline->decodeThread->wait();
+
+    AVPacket packet;
+    while (m_pipeline->packets.TryPop(packet))
+    {
+        av_free_packet(&packet);
+    }
+}
+
+void CFFmpegPlayer::convertFrame(const SDecodedFrame& frame, unsigned char* const* planes,
+                                 const int* lineSizes, const CCancelToken* cancel)
+{
+    if (planes == nullptr)
+    {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // The decode stage works on the next frames meanwhile
+    std::atomic<int> error(0);
+    const int count = static_cast<int>(m_bands.size());
+    CExecutor::GetInstance().RunParallel(count, [&](int i)
+    {
+        const int bandError = convertBand(frame, m_bands[i], planes, lineSizes, cancel);
+        if (bandError < 0)
+            error = bandError;
+    },
+    [&]()
+    {
+        return error < 0 || (cancel && cancel->IsCancelled());
+    });
+
+    CHECK_FFMPEG_RETURN_CODE(error, "sws_scale");
+
+    const int elapsedUs = static_cast<int>(timer.nsecsElapsed() / 1000);
+    m_lastConvertUs = elapsedUs;
+    m_convertUs += elapsedUs;
+    m_convertedFrames++;
+}
+
+int CFFmpegPlayer::convertBand(const SDecodedFrame& frame, const SConvertBand& band,
+                               unsigned char* const* planes, const int* lineSizes,
+                               const CCancelToken* cancel) const
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(m_codecCtx->pix_fmt);
+    const int sourceShift = desc ? desc->log2_chroma_h : 0;
+    const int outputShift = m_outputLayout == LAYOUT_YUV420 ? 1 : 0;
+
+    // the planes from the first row of the band on
+    const unsigned char* source[AV_NUM_DATA_POINTERS] = {};
+    for (int p = 0; p < AV_NUM_DATA_POINTERS && frame.picture.data[p]; ++p)
+    {
+        const int rows = band.sourceY >> plane_row_shift(p, sourceShift);
+        source[p] = frame.picture.data[p] + rows * frame.picture.linesize[p];
+    }
+    unsigned char* output[kMaxFramePlanes] = {};
+    const int planeCount = m_outputLayout == LAYOUT_YUV420 ? 3 : 1;
+    for (int p = 0; p < planeCount; ++p)
+    {
+        const int rows = band.outputY >> plane_row_shift(p, outputShift);
+        output[p] = planes[p] + rows * lineSizes[p];
+    }
+
+    // Slices go in order from the top of the band, the next frame starts at
+    // the top again if this one is cancelled
+    for (int y = 0; y < band.sourceRows; y += kScaleSliceRows)
+    {
+        if (cancel && cancel->IsCancelled())
+            break;
+
+        const int rows = std::min(kScaleSliceRows, band.sourceRows - y);
+        const int error = sws_scale(band.context, source, frame.picture.linesize, y, rows,
+                                    output, lineSizes);
+        if (error < 0)
+            return error;
+    }
+    return 0;
 }
 
 void CFFmpegPlayer::initFFmpeg()
 {
     av_register_all();
 }
+
+void CFFmpegPlayer::benchmarkDecode(std::ostream& out, const std::string& fileName, int maxThreads)
+{
+    const char* const names[] = { "single", "frame", "slice" };
+    const std::ios::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+
+    double singleFps = 0.0;
+    for (int threads = 1; threads <= std::max(maxThreads, 1); ++threads)
+    {
+        for (int threading = DECODE_SINGLE; threading <= DECODE_SLICE; ++threading)
+        {
+            if ((threads == 1) != (threading == DECODE_SINGLE))
+                continue;
+
+            CFFmpegPlayer player(fileName, static_cast<DECODE_THREADING>(threading), threads);
+            if (threads == 1)
+            {
+                out << "Decode benchmark: " << fileName << ", " << player.m_codecCtx->width << "x"
+                    << player.m_codecCtx->height << " " << player.m_codecCtx->codec->name << std::endl;
+            }
+
+            QElapsedTimer timer;
+            timer.start();
+
+            // stops as the movie starts over, or if it has no frames at all
+            int frames = 0;
+            unsigned int pts = 0;
+            unsigned int lastPts = 0;
+            for (int reads = 0; frames < kBenchmarkFrames && reads < 8 * kBenchmarkFrames; ++reads)
+            {
+                if (player.decodeFrame(pts, nullptr, nullptr))
+                {
+                    if (frames > 0 && pts < lastPts)
+                        break;
+                    lastPts = pts;
+                    ++frames;
+                }
+            }
+
+            const double fps = frames * 1e9 / std::max<qint64>(timer.nsecsElapsed(), 1);
+            if (threading == DECODE_SINGLE)
+                singleFps = fps;
+
+            out << "  " << std::left << std::setw(6) << names[threading] << std::right
+                << std::setw(3) << threads << " threads: " << std::fixed << std::setprecision(1)
+                << std::setw(7) << fps << " fps";
+            if (threading != DECODE_SINGLE)
+            {
+                out << " (" << std::setprecision(2) << fps / std::max(singleFps, 1e-9) << "x"
+                    << (player.getThreadCount() == 1 ? ", not supported by the codec" : "") << ")";
+            }
+            out << std::endl;
+        }
+    }
+
+    // The conversion at the size of the movie, of one frame over and over
+    CFFmpegPlayer player(fileName);
+    const int width = player.m_codecCtx->width;
+    const int height = player.m_codecCtx->height;
+    SDecodedFrame* decoded = player.takeDecodedFrame();
+    if (decoded->end)
+    {
+        // a movie without frames
+        player.m_pipeline->free.TryPush(decoded);
+        player.m_pipeline->framesFree.release();
+        decoded = nullptr;
+    }
+
+    if (decoded)
+    {
+        std::vector<unsigned char> frame(static_cast<size_t>(width) * height * GetGLPixelSize(GL_BGRA));
+        unsigned char* const planes[] = { frame.data() };
+        const int lineSizes[] = { width * GetGLPixelSize(GL_BGRA) };
+
+        // in one band, then in as many as the budget has cores
+        const int maxSlices = CThreadPlacement::GetInstance().GetCoreBudget();
+        const int sliceCounts[] = { 1, maxSlices };
+        double oneBandUs = 0.0;
+        for (int run = 0; run < (maxSlices > 1 ? 2 : 1); ++run)
+        {
+            player.setConvertSlices(sliceCounts[run]);
+            const unsigned long long startUs = player.m_convertUs;
+            for (int i = 0; i < kBenchmarkConversions; ++i)
+            {
+                player.convertFrame(*decoded, planes, lineSizes, nullptr);
+            }
+
+            const double us = static_cast<double>(player.m_convertUs - startUs) / kBenchmarkConversions;
+            if (run == 0)
+                oneBandUs = us;
+
+            out << "  convert to BGRA in " << std::setw(2) << player.m_convertSlices << " bands: "
+                << std::fixed << std::setprecision(2) << std::setw(7) << us / 1000.0 << " ms per frame";
+            if (run > 0)
+                out << " (" << oneBandUs / std::max(us, 1e-9) << "x)";
+            out << std::endl;
+        }
+        player.m_pipeline->free.TryPush(decoded);
+        player.m_pipeline->framesFree.release();
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
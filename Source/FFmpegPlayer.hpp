@@ -1,20 +1,69 @@
 #ifndef FFMPEGPLAYER_HPP
 #define FFMPEGPLAYER_HPP
 
+#include "Buffer.hpp"
+#include "ThreadPlacement.hpp"
+#include <atomic>
+#include <iosfwd>
 #include <memory>
 #include <string>
+#include <vector>
+
+class CCancelToken;
+
+struct SConvertStats
+{
+    unsigned long long frames;
+    // conversion time of all frames and of the last one
+    unsigned long long totalUs;
+    int lastUs;
+    // bands of the frame converted in parallel
+    int slices;
+};
+
+struct SPipelineStats
+{
+    // queued right now and the room of the queue
+    int packets;
+    int packetCapacity;
+    int frames;
+    int frameCapacity;
+    // queue fill the consumer of each queue found on average
+    double meanPackets;
+    double meanFrames;
+    // ms a stage waited: on a full output queue (backpressure) or on an
+    // empty input queue
+    unsigned long long demuxBlockedMs;
+    unsigned long long decodeBlockedMs;
+    unsigned long long decodeStarvedMs;
+    unsigned long long convertStarvedMs;
+};
 
 /**
  * @brief The CFFmpegPlayer class
  * @reentrant
+ *
+ * Runs as three stages connected by bounded lock-free queues: a demux
+ * thread reads the packets of the video stream, a decode thread decodes
+ * them into a small pool of frames and decodeFrame() converts those on the
+ * calling thread. A stage whose output queue is full waits, so the demuxer
+ * never runs further ahead than the packet queue holds. The demux and
+ * decode threads sleep on semaphores while they wait, the converting side
+ * asks frameReady() first instead of waiting.
  */
 class CFFmpegPlayer
 {
 public:
     /**
-     * Opens the movie file. Throws exception on failure.
+     * Opens the movie file and starts the demux and decode threads. Throws
+     * exception on failure.
+     * @param threading Decoder threads to run, the codec may not support
+     *        every kind. They are started with the placement of the executor.
+     * @param threads Decoder threads, 0 for as many as the frame size needs
+     *        for 60 fps, out of half the core budget at most.
      */
-    explicit CFFmpegPlayer(const std::string& fileName);
+    explicit CFFmpegPlayer(const std::string& fileName, DECODE_THREADING threading = DECODE_SINGLE,
+                           int threads = 1);
     ~CFFmpegPlayer();
 
     /**
@@ -23,27 +72,109 @@ public:
     static void initFFmpeg();
 
     /**
-     * Tries to decode a frame. Throws execption on failure. Frame is decoded as BGRA 8 bit per channel.
+     * Decodes the start of @p fileName single threaded and with 2 to
+     * @p maxThreads frame and slice threads and prints the frames per second
+     * to @p out. Then times the conversion of a frame to BGRA in one band
+     * and in bands on the executor threads.
+     */
+    static void benchmarkDecode(std::ostream& out, const std::string& fileName, int maxThreads);
+
+    /**
+     * True if decodeFrame() won't wait for the decode thread. Throws
+     * exception if a stage failed and every frame before is taken.
+     */
+    bool frameReady();
+
+    /**
+     * Takes the next decoded frame, waits for the decode thread if none is
+     * queued, see frameReady(). Throws execption if a stage failed. Frame is converted to BGRA
+     * 8 bit per channel, or to Y, U and V planes in LAYOUT_YUV420.
      * @param pts Present time of the decoded frame.
-     * @param data Pointer to the memory where to store the decoded data.
-     * @param lineSize Line size to use for the decoded data.
-     * @returns True if a new frame was decoded, else false.
+     * @param planes Pointers to the memory where to store the decoded planes. With
+     *        nullptr the frame is taken but not converted.
+     * @param lineSizes Line sizes to use for the planes.
+     * @param cancel Checked between slices of the conversion, a cancelled
+     *        frame is only partly converted and the next call converts it
+     *        again. The frame is converted in bands on the calling thread
+     *        and idle executor threads.
+     * @returns True if a new frame was taken, false at the end of the movie,
+     *          after which it starts over.
      */
-    bool decodeFrame(unsigned int& pts, unsigned char* data, int lineSize);
+    bool decodeFrame(unsigned int& pts, unsigned char* const* planes, const int* lineSizes,
+                     const CCancelToken* cancel = nullptr);
 
-    void setOutputSize(int width, int height);
+    void setOutputSize(int width, int height, FRAME_LAYOUT layout = LAYOUT_PACKED);
     int getOutputSize() const;
+    // Size of the decoded frames
+    void getSourceSize(int& width, int& height) const;
+    // Decoder threads which actually run, 1 if the codec runs none
+    int getThreadCount() const;
+    /**
+     * Most bands a frame is converted in, bands are at least 64 rows
+     * high. Call it from the thread which decodes.
+     */
+    void setConvertSlices(int slices);
+    // Can be called from any thread
+    SConvertStats getConvertStats() const;
+    // Can be called from any thread
+    SPipelineStats getPipelineStats() const;
 
 private:
+    struct SDecodedFrame;
+    struct SPipeline;
+
+    // Horizontal band of the frame with a scaler of its own
+    struct SConvertBand
+    {
+        struct SwsContext* context;
+        int sourceY;
+        int sourceRows;
+        int outputY;
+    };
+
+    // The stages, each runs on a thread of its own until the pipeline stops
+    void demux();
+    void decode();
+    // Decodes @p packet into as many frames of the pool as come out, false
+    // once the pipeline stops
+    bool decodePacket(struct AVPacket& packet);
+    // Waits for a frame of the pool, nullptr once the pipeline stops
+    SDecodedFrame* takeFreeFrame();
+    // Waits for the next decoded frame, throws if a stage failed
+    SDecodedFrame* takeDecodedFrame();
+    void stopPipeline();
+
+    void convertFrame(const SDecodedFrame& frame, unsigned char* const* planes,
+                      const int* lineSizes, const CCancelToken* cancel);
+    // Returns the first error of sws_scale(), 0 on success
+    int convertBand(const SDecodedFrame& frame, const SConvertBand& band,
+                    unsigned char* const* planes, const int* lineSizes,
+                    const CCancelToken* cancel) const;
+    // Splits the output into bands which start on a chroma row of the
+    // source and the output
+    void createBands();
+    void freeBands();
+
+    // released after the decoder threads have ended
+    std::unique_ptr<CCoreReservation> m_cores;
     std::unique_ptr<struct AVFormatContext, void (*)(struct AVFormatContext*)> m_formatCtx;
     std::unique_ptr<struct AVCodecContext, int (*)(struct AVCodecContext*)> m_codecCtx;
     std::unique_ptr<struct AVFrame, void (*)(struct AVFrame*)> m_frame;
-    struct SwsContext* m_swsCtx;
+    std::vector<SConvertBand> m_bands;
     int m_videoStream;
 
     int m_outputWidth;
     int m_outputHeight;
-    int m_pixelSize;
+    FRAME_LAYOUT m_outputLayout;
+    int m_maxSlices;
+
+    // stopped before the contexts above go
+    std::unique_ptr<SPipeline> m_pipeline;
+
+    std::atomic<unsigned long long> m_convertedFrames;
+    std::atomic<unsigned long long> m_convertUs;
+    std::atomic<int> m_lastConvertUs;
+    std::atomic<int> m_convertSlices;
 };
 
 #endif // FFMPEGPLAYER_HPP
@@ -1,77 +1,630 @@
 #include "Stdafx.hpp"
 #include "Fractal.hpp"
 #include "Buffer.hpp"
-#include <QTime>
+#include "CancelToken.hpp"
+#include "Executor.hpp"
+#include "FractalKernel.hpp"
+#include <QElapsedTimer>
+#include <algorithm>
 #include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
 
 namespace
 {
 
-    template <int N>
-    unsigned char juliaSet(float x, float y, const float seedX, const float seedY)
+    // 128 x 32 pixels = 4 KB of output per tile, small enough to balance
+    // well and to stay in L1 while a tile is written.
+    const int kTileWidth = 128;
+    const int kTileHeight = 32;
+
+    // Pixel steps of the progressive passes: 1/16, 1/4 and full resolution.
+    // Tile sizes are multiples of the coarsest step, so every tile starts on
+    // the coarse grid.
+    const int kProgressiveSteps[] = { 4, 2, 1 };
+
+    // A deeper tier costs up to twice as much. Only go deeper when the
+    // current frames take less than this share of half the budget, so the
+    // controller doesn't flip between two tiers.
+    const double kDepthUpMargin = 0.8;
+
+    // how far off the pixel grid a deep zoom symmetry center may be
+    const double kSymmetryTolerance = 1e-3;
+
+    // A frame stops early on StopGenerate(), which keeps what is done, or
+    // when it is cancelled, which drops it. Either one may be left out.
+    struct SStopCondition
     {
-        int i;
+        bool operator()() const
+        {
+            return (stop && *stop) || (cancel && cancel->IsCancelled());
+        }
 
-        x = 3.0f * (x - 0.5f);
-        y = 2.0f * (y - 0.5f);
+        const std::atomic<bool>* stop;
+        const CCancelToken* cancel;
+    };
 
-        for (i = 0; i < N; i++)
+    // Julia sets are symmetric under z -> -z. Pixel (i, j) shows the negated
+    // point of pixel (w - i - shiftX, h - j - shiftY), so rows [row0, row1)
+    // can take columns [col0, col1) from rows that are computed anyway.
+    struct SSymmetry
+    {
+        bool Init(int w, int h, int sx, int sy)
         {
-            float tx = (x * x - y * y) + seedX;
-            float ty = (y * x + x * y) + seedY;
+            width = w;
+            height = h;
+            shiftX = sx;
+            shiftY = sy;
 
-            if ((tx * tx + ty * ty) > 4.0)
+            // the partner column must be inside the frame
+            col0 = std::max(0, 1 - sx);
+            col1 = std::min(w, w - sx + 1);
+
+            // the partner row must be inside the frame and above this row,
+            // so it is never copied itself
+            row0 = h;
+            row1 = h;
+            for (int j = 0; j < h; ++j)
+            {
+                const int partner = h - j - sy;
+                if (partner >= 0 && partner < j)
+                {
+                    row0 = std::min(row0, j);
+                    row1 = j + 1;
+                }
+            }
+
+            return col0 < col1 && row0 < row1;
+        }
+
+        bool IsCopied(int i, int j) const
+        {
+            return j >= row0 && j < row1 && i >= col0 && i < col1;
+        }
+
+        // Copies every pixel of the copy region from its partner, one
+        // reversed row segment at a time.
+        void Mirror(unsigned char* data) const
+        {
+            for (int j = row0; j < row1; ++j)
             {
-                break;
+                const unsigned char* src = data + (height - j - shiftY) * width;
+                std::reverse_copy(src + width - shiftX - col1 + 1,
+                                  src + width - shiftX - col0 + 1,
+                                  data + j * width + col0);
             }
+        }
 
-            x = tx;
-            y = ty;
+        int CopiedPixels() const
+        {
+            return (row1 - row0) * (col1 - col0);
         }
 
-        return i == N ? 0 : i;
+        int width;
+        int height;
+        int shiftX;
+        int shiftY;
+        int row0;
+        int row1;
+        int col0;
+        int col1;
+    };
+
+    // Finds the pixel shift of the symmetry for the current view. The float
+    // view is centred on the origin. A deep zoom view only has a symmetry if
+    // the negated center lies on the pixel grid, e.g. after ResetView().
+    bool GetSymmetryShift(const SDeepZoomView& view, bool deepZoom, int width, int height,
+                          int& shiftX, int& shiftY)
+    {
+        if (! deepZoom)
+        {
+            shiftX = 0;
+            shiftY = 0;
+            return true;
+        }
+
+        const double x = 2.0 * view.centerX.hi * view.zoom * width / 3.0;
+        const double y = view.centerY.hi * view.zoom * height;
+        const double roundedX = std::floor(x + 0.5);
+        const double roundedY = std::floor(y + 0.5);
+        if (std::abs(x - roundedX) > kSymmetryTolerance ||
+            std::abs(y - roundedY) > kSymmetryTolerance ||
+            std::abs(roundedX) >= width || std::abs(roundedY) >= height)
+        {
+            return false;
+        }
+
+        shiftX = static_cast<int>(roundedX);
+        shiftY = static_cast<int>(roundedY);
+        return true;
     }
 
+    // Mariani-Silver subdivision: a rectangle whose border pixels all have
+    // the same count is filled with it, otherwise it is cut in two and both
+    // halves are checked again. Every pixel on a cut is computed.
+    struct SSubdivision
+    {
+        typedef std::function<void(int, int, int, int, unsigned char*)> RowFunc;
+        typedef std::function<void(const int*, const int*, int, unsigned char*)> PointsFunc;
+
+        // rectangles smaller than this are computed pixel by pixel
+        static const int kMinSize = 8;
+
+        SSubdivision(int w, unsigned char* out, const RowFunc& rowFunc,
+                     const PointsFunc& pointsFunc, const SStopCondition& stopCondition)
+            : width(w), data(out), row(rowFunc), points(pointsFunc), stopped(stopCondition),
+              filled(0)
+        {
+        }
+
+        struct SRect
+        {
+            int x0;
+            int y0;
+            int x1;
+            int y1;
+        };
+
+        // Rectangles are split level by level, and all pixels computed on
+        // one level go to the kernel in a single batch to fill SIMD lanes.
+        void Tile(int x0, int y0, int x1, int y1)
+        {
+            Row(y0, x0, x1);
+            if (y1 - 1 > y0)
+                Row(y1 - 1, x0, x1);
+            for (int j = y0 + 1; j < y1 - 1; ++j)
+            {
+                Add(x0, j);
+                if (x1 - 1 > x0)
+                    Add(x1 - 1, j);
+            }
+            Flush();
+
+            const SRect tile = { x0, y0, x1, y1 };
+            level.assign(1, tile);
+            while (! level.empty() && ! stopped())
+            {
+                next.clear();
+                for (size_t i = 0; i < level.size() && ! stopped(); ++i)
+                {
+                    Split(level[i]);
+                }
+                Flush();
+                level.swap(next);
+            }
+        }
+
+        // The border of rect is already computed. Either fills it, computes
+        // its inside, or queues the pixels of a cut and both halves.
+        void Split(const SRect& rect)
+        {
+            const int x0 = rect.x0;
+            const int y0 = rect.y0;
+            const int x1 = rect.x1;
+            const int y1 = rect.y1;
+            if (x1 - x0 <= 2 || y1 - y0 <= 2)
+                return;
+
+            const unsigned char value = data[y0 * width + x0];
+            if (IsBorderUniform(x0, y0, x1, y1, value))
+            {
+                for (int j = y0 + 1; j < y1 - 1; ++j)
+                {
+                    memset(data + j * width + x0 + 1, value, x1 - x0 - 2);
+                }
+                filled += (x1 - x0 - 2) * (y1 - y0 - 2);
+                return;
+            }
+
+            if (x1 - x0 < kMinSize || y1 - y0 < kMinSize)
+            {
+                for (int j = y0 + 1; j < y1 - 1; ++j)
+                {
+                    for (int i = x0 + 1; i < x1 - 1; ++i)
+                    {
+                        Add(i, j);
+                    }
+                }
+                return;
+            }
+
+            if (x1 - x0 >= y1 - y0)
+            {
+                const int mid = (x0 + x1) / 2;
+                for (int j = y0 + 1; j < y1 - 1; ++j)
+                {
+                    Add(mid, j);
+                }
+                const SRect left = { x0, y0, mid + 1, y1 };
+                const SRect right = { mid, y0, x1, y1 };
+                next.push_back(left);
+                next.push_back(right);
+            }
+            else
+            {
+                const int mid = (y0 + y1) / 2;
+                for (int i = x0 + 1; i < x1 - 1; ++i)
+                {
+                    Add(i, mid);
+                }
+                const SRect top = { x0, y0, x1, mid + 1 };
+                const SRect bottom = { x0, mid, x1, y1 };
+                next.push_back(top);
+                next.push_back(bottom);
+            }
+        }
+
+        bool IsBorderUniform(int x0, int y0, int x1, int y1, unsigned char value) const
+        {
+            const unsigned char* top = data + y0 * width;
+            const unsigned char* bottom = data + (y1 - 1) * width;
+            for (int i = x0; i < x1; ++i)
+            {
+                if (top[i] != value || bottom[i] != value)
+                    return false;
+            }
+            for (int j = y0 + 1; j < y1 - 1; ++j)
+            {
+                if (data[j * width + x0] != value || data[j * width + x1 - 1] != value)
+                    return false;
+            }
+            return true;
+        }
+
+        void Row(int j, int x0, int x1)
+        {
+            row(j, x0, x1, 1, data + j * width);
+        }
+
+        // pixels are batched so the points kernel can vectorize them
+        void Add(int i, int j)
+        {
+            xs.push_back(i);
+            ys.push_back(j);
+        }
+
+        void Flush()
+        {
+            const int count = static_cast<int>(xs.size());
+            if (count == 0)
+                return;
+
+            values.resize(count);
+            points(xs.data(), ys.data(), count, values.data());
+            for (int k = 0; k < count; ++k)
+            {
+                data[ys[k] * width + xs[k]] = values[k];
+            }
+            xs.clear();
+            ys.clear();
+        }
+
+        const int width;
+        unsigned char* const data;
+        const RowFunc& row;
+        const PointsFunc& points;
+        const SStopCondition stopped;
+        int filled;
+        std::vector<int> xs;
+        std::vector<int> ys;
+        std::vector<unsigned char> values;
+        std::vector<SRect> level;
+        std::vector<SRect> next;
+    };
+
 }
 
-CFractal::CFractal(): m_seed(0.0f, 0.0f), m_animated(true), m_stop(false)
+CFractal::CFractal(): m_seed(0.0f, 0.0f), m_animated(true), m_progressive(false),
+                      m_stop(false), m_cancel(nullptr), m_isa(DetectFractalISA()),
+                      m_depth(DEPTH_256), m_lastFrameDepth(DEPTH_256),
+                      m_frameBudgetMs(0), m_skippedIterations(0),
+                      m_lastFrameSkipped(0), m_subdivision(false),
+                      m_filledPixels(0), m_lastFrameFilled(0),
+                      m_symmetric(false), m_mirroredPixels(0), m_lastFrameMirrored(0),
+                      m_deepZoom(false), m_rebaseCount(0)
 {
+    for (auto& count : m_depthFrames)
+    {
+        count = 0;
+    }
+    ResetView();
 }
 
 CFractal::~CFractal()
 {
 }
 
-bool CFractal::GenerateFractal(int width, int height, unsigned char* data)
+bool CFractal::GenerateFractal(int width, int height, unsigned char* data,
+                               const PassCallback& onCoarsePass, const CCancelToken* cancel)
 {
-    // Set a stop flag check point in each row. We try to check it
-    // each 200 point.
-    const int rowCheckPoint = (width > 200) ? 1 : (200 / width);
+    // RunTiles() checks it as well
+    m_cancel = cancel;
+    const SStopCondition stopped = { &m_stop, cancel };
+    const SStopCondition cancelled = { nullptr, cancel };
 
-    if (m_animated)
+    const SJuliaParam param = { width, height,
+                                static_cast<float>(m_seed.x()),
+                                static_cast<float>(m_seed.y()) };
+    const FRACTAL_DEPTH depth = static_cast<FRACTAL_DEPTH>(m_depth.load());
+    const int maxIteration = GetFractalDepthIteration(depth);
+    const JuliaRowFunc juliaKernel = GetJuliaRowFunc(m_isa, depth);
+    const JuliaPointsFunc juliaPointsKernel = GetJuliaPointsFunc(m_isa, depth);
+    QElapsedTimer timer;
+    timer.start();
+    m_skippedIterations = 0;
+    const SDeepZoomView view = GetView();
+    bool deepZoom;
     {
-        float t = QTime::currentTime().msecsSinceStartOfDay() / 5000.0;
-        m_seed.rx() = (std::sin(std::cos(t / 10.0f) * 10.0f) + std::cos(t * 2.0f) / 4.0f + std::sin(t * 3.0f) / 6.0f) * 0.8f;
-        m_seed.ry() = (std::cos(std::sin(t / 10.0f) * 10.0f) + std::sin(t * 2.0f) / 4.0f + std::cos(t * 3.0f) / 6.0f) * 0.8f;
+        QMutexLocker locker(&m_viewMutex);
+        deepZoom = m_deepZoom;
+    }
+
+    std::function<void(int, int, int, int, unsigned char*)> kernelRow;
+    std::function<void(const int*, const int*, int, unsigned char*)> juliaPoints;
+    if (deepZoom)
+    {
+        // one reference orbit per frame, from the view center, and the orbit
+        // of the critical point 0 for pixels that need rebasing
+        m_reference.Compute(view.centerX, view.centerY, m_seed.x(), m_seed.y(),
+                            maxIteration);
+        m_critical.Compute(MakeDoubleDouble(0.0), MakeDoubleDouble(0.0),
+                           m_seed.x(), m_seed.y(), maxIteration);
+
+        kernelRow = [&](int j, int x0, int x1, int step, unsigned char* row)
+        {
+            m_rebaseCount += PerturbedJuliaRow(view, width, height, m_reference,
+                                               m_critical, maxIteration,
+                                               j, x0, x1, step, row);
+        };
+        juliaPoints = [&](const int* xs, const int* ys, int count, unsigned char* out)
+        {
+            int rebases = 0;
+            for (int k = 0; k < count; ++k)
+            {
+                out[k] = PerturbedJuliaPixel(view, width, height, m_reference, m_critical,
+                                             maxIteration, xs[k], ys[k], rebases);
+            }
+            m_rebaseCount += rebases;
+        };
+    }
+    else
+    {
+        kernelRow = [&](int j, int x0, int x1, int step, unsigned char* row)
+        {
+            m_skippedIterations += juliaKernel(param, j, x0, x1, step, row);
+        };
+        juliaPoints = [&](const int* xs, const int* ys, int count, unsigned char* out)
+        {
+            m_skippedIterations += juliaPointsKernel(param, xs, ys, count, out);
+        };
+    }
+
+    SSymmetry symmetry;
+    int shiftX = 0;
+    int shiftY = 0;
+    const bool symmetric = m_symmetric &&
+                           GetSymmetryShift(view, deepZoom, width, height, shiftX, shiftY) &&
+                           symmetry.Init(width, height, shiftX, shiftY);
+    m_mirroredPixels = symmetric ? symmetry.CopiedPixels() : 0;
+
+    // Skips the copy region in the symmetric mode, it is mirrored at the
+    // end of every pass.
+    const auto juliaRow = [&](int j, int x0, int x1, int step, unsigned char* row)
+    {
+        if (! symmetric || j < symmetry.row0 || j >= symmetry.row1)
+        {
+            kernelRow(j, x0, x1, step, row);
+            return;
+        }
+
+        const int left = std::min(x1, symmetry.col0);
+        if (x0 < left)
+            kernelRow(j, x0, left, step, row);
+
+        int right = std::max(x0, symmetry.col1);
+        right += (step - (right - x0) % step) % step;
+        if (right < x1)
+            kernelRow(j, right, x1, step, row);
+    };
+
+    const int tilesPerRow = (width + kTileWidth - 1) / kTileWidth;
+    const int tileRows = (height + kTileHeight - 1) / kTileHeight;
+    const int tileCount = tilesPerRow * tileRows;
+
+    // full resolution pass by subdivision, each tile on its own
+    const auto subdivideTile = [&](int tile)
+    {
+        const int x0 = (tile % tilesPerRow) * kTileWidth;
+        const int x1 = std::min(x0 + kTileWidth, width);
+        const int y0 = (tile / tilesPerRow) * kTileHeight;
+        const int y1 = std::min(y0 + kTileHeight, height);
+
+        // Tiles partly in the copy region are subdivided as a whole, the
+        // uniform border test needs real pixels.
+        if (symmetric && symmetry.IsCopied(x0, y0) && symmetry.IsCopied(x1 - 1, y1 - 1))
+            return;
+
+        SSubdivision subdivision(width, data, kernelRow, juliaPoints, stopped);
+        subdivision.Tile(x0, y0, x1, y1);
+        m_filledPixels += subdivision.filled;
+    };
+    m_filledPixels = 0;
+
+    if (! m_progressive && m_subdivision)
+    {
+        RunTiles(tileCount, subdivideTile);
+    }
+    else if (! m_progressive)
+    {
+        RunTiles(tileCount, [&](int tile)
+        {
+            const int x0 = (tile % tilesPerRow) * kTileWidth;
+            const int x1 = std::min(x0 + kTileWidth, width);
+            const int y0 = (tile / tilesPerRow) * kTileHeight;
+            const int y1 = std::min(y0 + kTileHeight, height);
+
+            for (int j = y0; j < y1 && ! stopped(); ++j)
+            {
+                juliaRow(j, x0, x1, 1, data + j * width);
+            }
+        });
     }
 
-    for (int j = 0; j < height; ++j)
+    if (! m_progressive && symmetric)
     {
-        for (int i = 0; i < width; ++i)
+        symmetry.Mirror(data);
+    }
+
+    const int passCount = m_progressive ? sizeof(kProgressiveSteps) / sizeof(kProgressiveSteps[0]) : 0;
+    for (int pass = 0; pass < passCount && (pass == 0 || ! stopped()); ++pass)
+    {
+        const int step = kProgressiveSteps[pass];
+        const int prevStep = pass > 0 ? kProgressiveSteps[pass - 1] : 0;
+        // the first pass always runs to the end, so the buffer never holds
+        // a half-written image, unless the frame is dropped anyway
+        const bool cancellable = pass > 0;
+
+        // Subdivision can't make use of the coarse pixels and recomputes
+        // them. It replaces the last pass only, so the coarse passes still
+        // show up early.
+        if (step == 1 && m_subdivision)
+        {
+            RunTiles(tileCount, subdivideTile);
+        }
+        else RunTiles(tileCount, [&](int tile)
+        {
+            const int x0 = (tile % tilesPerRow) * kTileWidth;
+            const int x1 = std::min(x0 + kTileWidth, width);
+            const int y0 = (tile / tilesPerRow) * kTileHeight;
+            const int y1 = std::min(y0 + kTileHeight, height);
+
+            for (int j = y0; j < y1 && ! (cancellable ? stopped() : cancelled()); j += step)
+            {
+                unsigned char* row = data + j * width;
+
+                // skip the pixels the previous pass already computed
+                if (prevStep && j % prevStep == 0)
+                    juliaRow(j, x0 + step, x1, prevStep, row);
+                else
+                    juliaRow(j, x0, x1, step, row);
+
+                if (step == 1)
+                    continue;
+
+                // stretch every grid pixel over its step x step block
+                for (int i = x0; i < x1; i += step)
+                {
+                    memset(row + i, row[i], std::min(step, x1 - i));
+                }
+                for (int k = j + 1; k < std::min(j + step, y1); ++k)
+                {
+                    memcpy(data + k * width + x0, row + x0, x1 - x0);
+                }
+            }
+        }, cancellable);
+
+        if (symmetric)
         {
-            int value = juliaSet<256>(i / static_cast<float>(width), j / static_cast<float>(height), m_seed.rx(), m_seed.ry());
-            // TODO: *(static_cast<unsigned char*>(buffer) + i + j * width) = value;
-            *(data + i + j * width) = value;
+            symmetry.Mirror(data);
         }
 
-        if (j % rowCheckPoint == 0 && m_stop)
+        if (step > 1 && ! stopped() && onCoarsePass)
         {
-            m_stop = false;
-            break;
+            onCoarsePass(passCount - pass - 1);
         }
     }
 
-    return true;
+    // consume the stop request
+    const bool completed = ! stopped();
+    m_stop = false;
+    m_cancel = nullptr;
+
+    // stopped frames say nothing about the cost of a whole frame
+    if (completed)
+    {
+        m_lastFrameDepth = depth;
+        m_depthFrames[depth]++;
+        m_lastFrameSkipped = m_skippedIterations.load();
+        m_lastFrameFilled = m_filledPixels.load();
+        m_lastFrameMirrored = m_mirroredPixels.load();
+        AdaptIterationDepth(timer.elapsed());
+    }
+    return completed;
+}
+
+void CFractal::AdaptIterationDepth(qint64 frameMs)
+{
+    const int budgetMs = m_frameBudgetMs;
+    const int depth = m_depth;
+    if (budgetMs <= 0)
+        return;
+
+    if (frameMs > budgetMs && depth > DEPTH_64)
+    {
+        m_depth = depth - 1;
+    }
+    else if (frameMs * 2 < budgetMs * kDepthUpMargin && depth < DEPTH_1024)
+    {
+        m_depth = depth + 1;
+    }
+}
+
+void CFractal::AdvanceAnimation(qint64 timeMs)
+{
+    if (m_animated)
+    {
+        float t = timeMs / 5000.0;
+        m_seed.rx() = (std::sin(std::cos(t / 10.0f) * 10.0f) + std::cos(t * 2.0f) / 4.0f + std::sin(t * 3.0f) / 6.0f) * 0.8f;
+        m_seed.ry() = (std::cos(std::sin(t / 10.0f) * 10.0f) + std::sin(t * 2.0f) / 4.0f + std::cos(t * 3.0f) / 6.0f) * 0.8f;
+    }
+}
+
+unsigned long long CFractal::GetContentVersion(int width, int height) const
+{
+    // Everything the pixels depend on. The kernel ISA and progressive mode
+    // are left out on purpose, they produce identical images.
+    struct
+    {
+        float seedX;
+        float seedY;
+        int width;
+        int height;
+        int depth;
+        int subdivision;
+        int symmetric;
+    } inputs = { static_cast<float>(m_seed.x()), static_cast<float>(m_seed.y()),
+                 width, height, m_depth, m_subdivision, m_symmetric };
+
+    QMutexLocker locker(&m_viewMutex);
+    if (! m_deepZoom)
+    {
+        return CBuffer::MakeVersion(&inputs, sizeof(inputs));
+    }
+
+    // deep zoom uses the seed in double precision
+    struct
+    {
+        double seedX;
+        double seedY;
+        SDeepZoomView view;
+        int width;
+        int height;
+        int depth;
+        int subdivision;
+        int symmetric;
+    } deepInputs = { m_seed.x(), m_seed.y(), m_view, width, height, m_depth,
+                     m_subdivision, m_symmetric };
+
+    return CBuffer::MakeVersion(&deepInputs, sizeof(deepInputs));
+}
+
+void CFractal::RunTiles(int tileCount, const std::function<void(int)>& body,
+                        bool cancellable)
+{
+    // a cancelled frame is dropped, so every pass stops for that
+    const SStopCondition stopped = { cancellable ? &m_stop : nullptr, m_cancel };
+    CExecutor::GetInstance().RunParallel(tileCount, body, stopped);
 }
 
 void CFractal::SetAnimated(bool animated)
@@ -79,12 +632,240 @@ void CFractal::SetAnimated(bool animated)
     m_animated = animated;
 }
 
+void CFractal::SetProgressive(bool progressive)
+{
+    m_progressive = progressive;
+}
+
+bool CFractal::IsProgressive() const
+{
+    return m_progressive;
+}
+
 void CFractal::SetSeedPoint(QPointF seed)
 {
     m_seed = seed;
 }
 
+void CFractal::SetKernelISA(FRACTAL_ISA isa)
+{
+    if (IsFractalISASupported(isa))
+    {
+        m_isa = isa;
+    }
+}
+
+FRACTAL_ISA CFractal::GetKernelISA() const
+{
+    return m_isa;
+}
+
+void CFractal::SetIterationDepth(FRACTAL_DEPTH depth)
+{
+    m_depth = depth;
+}
+
+FRACTAL_DEPTH CFractal::GetIterationDepth() const
+{
+    return static_cast<FRACTAL_DEPTH>(m_depth.load());
+}
+
+void CFractal::SetFrameBudget(int budgetMs)
+{
+    m_frameBudgetMs = budgetMs;
+}
+
+int CFractal::GetFrameBudget() const
+{
+    return m_frameBudgetMs;
+}
+
+FRACTAL_DEPTH CFractal::GetLastFrameDepth() const
+{
+    return static_cast<FRACTAL_DEPTH>(m_lastFrameDepth.load());
+}
+
+unsigned long long CFractal::GetDepthFrameCount(FRACTAL_DEPTH depth) const
+{
+    return m_depthFrames[depth];
+}
+
+unsigned long long CFractal::GetLastFrameSkippedIterations() const
+{
+    return m_lastFrameSkipped;
+}
+
+void CFractal::SetSubdivision(bool subdivision)
+{
+    m_subdivision = subdivision;
+}
+
+bool CFractal::IsSubdivision() const
+{
+    return m_subdivision;
+}
+
+unsigned long long CFractal::GetLastFrameFilledPixels() const
+{
+    return m_lastFrameFilled;
+}
+
+void CFractal::SetSymmetric(bool symmetric)
+{
+    m_symmetric = symmetric;
+}
+
+bool CFractal::IsSymmetric() const
+{
+    return m_symmetric;
+}
+
+unsigned long long CFractal::GetLastFrameMirroredPixels() const
+{
+    return m_lastFrameMirrored;
+}
+
+void CFractal::BenchmarkKernels(int width, int height)
+{
+    BenchmarkJuliaKernels(std::cout, width, height,
+                          static_cast<float>(m_seed.x()),
+                          static_cast<float>(m_seed.y()));
+    CompareRenderModes(width, height);
+}
+
+void CFractal::CompareRenderModes(int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    const size_t size = static_cast<size_t>(width) * height;
+    std::unique_ptr<unsigned char[]> reference(new unsigned char[size]);
+    std::unique_ptr<unsigned char[]> result(new unsigned char[size]);
+
+    // whole frames at the current depth, without adapting it
+    const bool progressive = m_progressive;
+    const bool subdivision = m_subdivision;
+    const bool symmetric = m_symmetric;
+    const int budgetMs = m_frameBudgetMs;
+    m_progressive = false;
+    m_frameBudgetMs = 0;
+
+    // renders one frame in the given mode, returns the time and the pixels
+    // that differ from the brute force frame
+    QElapsedTimer timer;
+    const auto render = [&](bool subdivide, bool mirror, unsigned char* out,
+                            qint64& ns) -> size_t
+    {
+        m_subdivision = subdivide;
+        m_symmetric = mirror;
+        timer.start();
+        GenerateFractal(width, height, out);
+        ns = timer.nsecsElapsed();
+
+        size_t mismatches = 0;
+        for (size_t k = 0; k < size; ++k)
+        {
+            if (reference[k] != out[k])
+                ++mismatches;
+        }
+        return mismatches;
+    };
+
+    qint64 bruteNs, subdivisionNs, symmetricNs;
+    render(false, false, reference.get(), bruteNs);
+    const size_t subdivisionMismatches = render(true, false, result.get(), subdivisionNs);
+    const unsigned long long filled = m_lastFrameFilled;
+    const size_t symmetricMismatches = render(false, true, result.get(), symmetricNs);
+    const unsigned long long mirrored = m_lastFrameMirrored;
+
+    m_progressive = progressive;
+    m_subdivision = subdivision;
+    m_symmetric = symmetric;
+    m_frameBudgetMs = budgetMs;
+
+    std::cout << "Render modes vs brute force, "
+              << GetFractalDepthIteration(GetIterationDepth()) << " iterations:" << std::endl
+              << "  brute force: " << bruteNs / 1000000.0 << " ms" << std::endl
+              << "  subdivision: " << subdivisionNs / 1000000.0 << " ms, "
+              << 100.0 * filled / size << "% filled, "
+              << subdivisionMismatches << " pixels differ" << std::endl
+              << "  symmetric:   " << symmetricNs / 1000000.0 << " ms, "
+              << 100.0 * mirrored / size << "% mirrored, "
+              << symmetricMismatches << " pixels differ" << std::endl;
+}
+
 void CFractal::StopGenerate()
 {
     m_stop = true;
 }
+
+SDeepZoomView CFractal::GetView() const
+{
+    QMutexLocker locker(&m_viewMutex);
+    return m_view;
+}
+
+void CFractal::SetDeepZoom(bool enabled)
+{
+    QMutexLocker locker(&m_viewMutex);
+    m_deepZoom = enabled;
+}
+
+bool CFractal::IsDeepZoom() const
+{
+    QMutexLocker locker(&m_viewMutex);
+    return m_deepZoom;
+}
+
+void CFractal::ZoomAt(double x, double y, int width, int height, double factor)
+{
+    {
+        QMutexLocker locker(&m_viewMutex);
+
+        const double zoom = std::max(1.0, std::min(m_view.zoom * factor, kMaxDeepZoom));
+
+        // keep the point under (x, y) in place
+        const double offsetX = 3.0 * (x / width - 0.5);
+        const double offsetY = 2.0 * (y / height - 0.5);
+        const double shift = 1.0 / m_view.zoom - 1.0 / zoom;
+
+        m_view.centerX = m_view.centerX + MakeDoubleDouble(offsetX * shift);
+        m_view.centerY = m_view.centerY + MakeDoubleDouble(offsetY * shift);
+        m_view.zoom = zoom;
+    }
+
+    StopGenerate();
+}
+
+void CFractal::Pan(double dx, double dy, int width, int height)
+{
+    {
+        QMutexLocker locker(&m_viewMutex);
+
+        // the image follows the mouse, so the center moves the other way
+        m_view.centerX = m_view.centerX - MakeDoubleDouble(3.0 * dx / width / m_view.zoom);
+        m_view.centerY = m_view.centerY - MakeDoubleDouble(2.0 * dy / height / m_view.zoom);
+    }
+
+    StopGenerate();
+}
+
+void CFractal::ResetView()
+{
+    QMutexLocker locker(&m_viewMutex);
+
+    m_view.centerX = MakeDoubleDouble(0.0);
+    m_view.centerY = MakeDoubleDouble(0.0);
+    m_view.zoom = 1.0;
+}
+
+double CFractal::GetZoom() const
+{
+    QMutexLocker locker(&m_viewMutex);
+    return m_view.zoom;
+}
+
+unsigned long long CFractal::GetRebaseCount() const
+{
+    return m_rebaseCount;
+}
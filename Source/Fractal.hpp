@@ -1,8 +1,15 @@
 #ifndef FRACTAL_HPP
 #define FRACTAL_HPP
 
+#include <QMutex>
 #include <QObject>
 #include <QPointF>
+#include <atomic>
+#include <functional>
+#include "FractalDeepZoom.hpp"
+#include "FractalKernel.hpp"
+
+class CCancelToken;
 
 class CFractal
 {
@@ -10,15 +17,117 @@ public:
     CFractal();
     virtual ~CFractal();
 
-    bool GenerateFractal(int width, int height, unsigned char* data);
+    // Called after each coarse pass of a progressive frame, with the number
+    // of refinement passes still to come. The buffer then holds a complete,
+    // lower resolution image.
+    typedef std::function<void(int passesLeft)> PassCallback;
+
+    // Returns false if the frame was stopped before it was complete. A
+    // cancelled frame stops within a tile row, even in the first pass, and
+    // leaves the image incomplete.
+    bool GenerateFractal(int width, int height, unsigned char* data,
+                         const PassCallback& onCoarsePass = PassCallback(),
+                         const CCancelToken* cancel = nullptr);
+    // Moves the seed to where it is on its path at timeMs if the fractal is
+    // animated. The same time always gives the same image.
+    void AdvanceAnimation(qint64 timeMs);
+    // Identifies the image GenerateFractal() would produce right now
+    unsigned long long GetContentVersion(int width, int height) const;
     void SetAnimated(bool animated);
+    // Progressive frames are computed at 1/16, 1/4 and then full resolution.
+    // Only the refinement passes can be stopped, so a stopped frame is
+    // still a complete (coarser) image.
+    void SetProgressive(bool progressive);
+    bool IsProgressive() const;
     void SetSeedPoint(QPointF position);
     void StopGenerate();
 
+    // Deep zoom renders the view with perturbation in double precision
+    // instead of the fixed float view. Zoom and pan work in window pixels
+    // and stop the frame in progress.
+    void SetDeepZoom(bool enabled);
+    bool IsDeepZoom() const;
+    void ZoomAt(double x, double y, int width, int height, double factor);
+    void Pan(double dx, double dy, int width, int height);
+    void ResetView();
+    double GetZoom() const;
+    // Pixels rebased onto the critical orbit, summed over all frames
+    unsigned long long GetRebaseCount() const;
+
+    // Iteration depth of the next frame. With a frame budget the depth is
+    // adapted after every frame: the deepest tier whose frames still fit in
+    // budgetMs is used. A budget of 0 keeps the depth fixed.
+    void SetIterationDepth(FRACTAL_DEPTH depth);
+    FRACTAL_DEPTH GetIterationDepth() const;
+    void SetFrameBudget(int budgetMs);
+    int GetFrameBudget() const;
+    // Depth of the last completed frame, and completed frames per depth
+    FRACTAL_DEPTH GetLastFrameDepth() const;
+    unsigned long long GetDepthFrameCount(FRACTAL_DEPTH depth) const;
+    // Iterations the periodicity check saved in the last completed frame
+    unsigned long long GetLastFrameSkippedIterations() const;
+
+    // Subdivision (Mariani-Silver) computes the full resolution image from
+    // rectangle borders and fills uniform rectangles without iterating them.
+    // Results can differ from the brute force path where a detail lies
+    // completely inside a uniform border.
+    void SetSubdivision(bool subdivision);
+    bool IsSubdivision() const;
+    unsigned long long GetLastFrameFilledPixels() const;
+
+    // The symmetric mode uses f(-z) = f(z) and copies the point reflection of
+    // what is already computed. Only works if the view is centred on the
+    // origin or the negated center lies on the pixel grid, otherwise the
+    // whole frame is computed. Mirrored pixels match computed ones exactly.
+    void SetSymmetric(bool symmetric);
+    bool IsSymmetric() const;
+    unsigned long long GetLastFrameMirroredPixels() const;
+
+    // Kernel is chosen by CPU detection, SetKernelISA() is for testing only
+    void SetKernelISA(FRACTAL_ISA isa);
+    FRACTAL_ISA GetKernelISA() const;
+    // Also compares subdivision and symmetric mode against brute force, stop
+    // workers first
+    void BenchmarkKernels(int width, int height);
+
 private:
+    // Runs body(tile) for tile in [0, tileCount) with CExecutor::RunParallel().
+    // Tiles are handed out one at a time, so slow tiles near the set boundary
+    // don't hold up a statically assigned band of the image.
+    void RunTiles(int tileCount, const std::function<void(int)>& body,
+                  bool cancellable = true);
+    SDeepZoomView GetView() const;
+    void AdaptIterationDepth(qint64 frameMs);
+    void CompareRenderModes(int width, int height);
+
     QPointF m_seed;
     bool m_animated;
-    bool m_stop;
+    bool m_progressive;
+    std::atomic<bool> m_stop;
+    // of the frame in progress
+    const CCancelToken* m_cancel;
+    FRACTAL_ISA m_isa;
+
+    std::atomic<int> m_depth;
+    std::atomic<int> m_lastFrameDepth;
+    std::atomic<int> m_frameBudgetMs;
+    std::atomic<unsigned long long> m_depthFrames[DEPTH_TOTAL];
+    std::atomic<unsigned long long> m_skippedIterations;
+    std::atomic<unsigned long long> m_lastFrameSkipped;
+    std::atomic<bool> m_subdivision;
+    std::atomic<unsigned long long> m_filledPixels;
+    std::atomic<unsigned long long> m_lastFrameFilled;
+    std::atomic<bool> m_symmetric;
+    std::atomic<unsigned long long> m_mirroredPixels;
+    std::atomic<unsigned long long> m_lastFrameMirrored;
+
+    // the view is changed by the GUI thread while a worker renders it
+    mutable QMutex m_viewMutex;
+    SDeepZoomView m_view;
+    bool m_deepZoom;
+    CReferenceOrbit m_reference;
+    CReferenceOrbit m_critical;
+    std::atomic<unsigned long long> m_rebaseCount;
 };
 
 #endif // FRACTAL_HPP
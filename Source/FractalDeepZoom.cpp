@@ -0,0 +1,179 @@
+#include "Stdafx.hpp"
+#include "FractalDeepZoom.hpp"
+
+// Double-double arithmetic relies on every product and sum being rounded on
+// its own, a fused multiply-add would break the error terms.
+#if defined(_MSC_VER)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace
+{
+
+    // a + b = s + err exactly
+    inline SDoubleDouble TwoSum(double a, double b)
+    {
+        const double s = a + b;
+        const double bb = s - a;
+        const SDoubleDouble r = { s, (a - (s - bb)) + (b - bb) };
+        return r;
+    }
+
+    // same as TwoSum() if |a| >= |b|
+    inline SDoubleDouble QuickTwoSum(double a, double b)
+    {
+        const double s = a + b;
+        const SDoubleDouble r = { s, b - (s - a) };
+        return r;
+    }
+
+    // a * b = p + err exactly (Dekker)
+    inline SDoubleDouble TwoProd(double a, double b)
+    {
+        const double kSplit = 134217729.0;  // 2^27 + 1
+
+        const double ta = kSplit * a;
+        const double ahi = ta - (ta - a);
+        const double alo = a - ahi;
+        const double tb = kSplit * b;
+        const double bhi = tb - (tb - b);
+        const double blo = b - bhi;
+
+        const double p = a * b;
+        const SDoubleDouble r = { p, ((ahi * bhi - p) + ahi * blo + alo * bhi) + alo * blo };
+        return r;
+    }
+
+}
+
+SDoubleDouble MakeDoubleDouble(double value)
+{
+    const SDoubleDouble r = { value, 0.0 };
+    return r;
+}
+
+SDoubleDouble operator+(const SDoubleDouble& a, const SDoubleDouble& b)
+{
+    SDoubleDouble s = TwoSum(a.hi, b.hi);
+    const SDoubleDouble t = TwoSum(a.lo, b.lo);
+
+    s.lo += t.hi;
+    s = QuickTwoSum(s.hi, s.lo);
+    s.lo += t.lo;
+    return QuickTwoSum(s.hi, s.lo);
+}
+
+SDoubleDouble operator-(const SDoubleDouble& a, const SDoubleDouble& b)
+{
+    const SDoubleDouble negB = { -b.hi, -b.lo };
+    return a + negB;
+}
+
+SDoubleDouble operator*(const SDoubleDouble& a, const SDoubleDouble& b)
+{
+    SDoubleDouble p = TwoProd(a.hi, b.hi);
+    p.lo += a.hi * b.lo + a.lo * b.hi;
+    return QuickTwoSum(p.hi, p.lo);
+}
+
+void CReferenceOrbit::Compute(const SDoubleDouble& x, const SDoubleDouble& y,
+                              double seedX, double seedY, int maxIteration)
+{
+    const SDoubleDouble cx = MakeDoubleDouble(seedX);
+    const SDoubleDouble cy = MakeDoubleDouble(seedY);
+    SDoubleDouble zx = x;
+    SDoubleDouble zy = y;
+
+    m_x.clear();
+    m_y.clear();
+    m_x.push_back(zx.hi);
+    m_y.push_back(zy.hi);
+
+    for (int n = 0; n < maxIteration; ++n)
+    {
+        const SDoubleDouble tx = (zx * zx - zy * zy) + cx;
+        const SDoubleDouble ty = (zx * zy + zx * zy) + cy;
+        zx = tx;
+        zy = ty;
+
+        m_x.push_back(zx.hi);
+        m_y.push_back(zy.hi);
+
+        if (zx.hi * zx.hi + zy.hi * zy.hi > 4.0)
+            break;
+    }
+}
+
+int CReferenceOrbit::GetLength() const
+{
+    return static_cast<int>(m_x.size());
+}
+
+unsigned char PerturbedJuliaPixel(const SDeepZoomView& view, int width, int height,
+                                  const CReferenceOrbit& reference,
+                                  const CReferenceOrbit& critical, int maxIteration,
+                                  int i, int j, int& rebases)
+{
+    // Offsets from the center are small doubles even at deep zoom, only the
+    // center itself needs the extra precision.
+    const CReferenceOrbit* orbit = &reference;
+    int m = 0;
+    double dx = 3.0 * (i / static_cast<double>(width) - 0.5) / view.zoom;
+    double dy = 2.0 * (j / static_cast<double>(height) - 0.5) / view.zoom;
+    int n;
+
+    for (n = 0; n < maxIteration; ++n)
+    {
+        // z = Z + d  =>  z * z + seed = Z' + (2 * Z * d + d * d)
+        const double zx = orbit->m_x[m];
+        const double zy = orbit->m_y[m];
+        const double tx = 2.0 * (zx * dx - zy * dy) + (dx * dx - dy * dy);
+        const double ty = 2.0 * (zx * dy + zy * dx) + 2.0 * dx * dy;
+        dx = tx;
+        dy = ty;
+        ++m;
+
+        const double px = orbit->m_x[m] + dx;
+        const double py = orbit->m_y[m] + dy;
+        const double len = px * px + py * py;
+        if (len > 4.0)
+        {
+            break;
+        }
+
+        // The pixel came closer to the critical point 0 than to the
+        // reference, its delta has lost the precision that matters here.
+        // Continue from the orbit of 0 where the delta is the pixel itself.
+        if (len < dx * dx + dy * dy || m + 1 >= orbit->GetLength())
+        {
+            orbit = &critical;
+            m = 0;
+            dx = px;
+            dy = py;
+            ++rebases;
+        }
+    }
+
+    // same 8-bit scaling as the iteration tiers of the float kernels
+    return n == maxIteration ? 0 : static_cast<unsigned char>(n * 256 / maxIteration);
+}
+
+int PerturbedJuliaRow(const SDeepZoomView& view, int width, int height,
+                      const CReferenceOrbit& reference,
+                      const CReferenceOrbit& critical, int maxIteration,
+                      int row, int x0, int x1, int step, unsigned char* out)
+{
+    int rebases = 0;
+
+    for (int i = x0; i < x1; i += step)
+    {
+        out[i] = PerturbedJuliaPixel(view, width, height, reference, critical,
+                                     maxIteration, i, row, rebases);
+    }
+
+    return rebases;
+}
@@ -0,0 +1,77 @@
+#ifndef FRACTALDEEPZOOM_HPP
+#define FRACTALDEEPZOOM_HPP
+
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Deep zoom by perturbation. One reference orbit is iterated in double-double
+// precision, every pixel only iterates its small difference (delta) to that
+// orbit in double precision.
+// ----------------------------------------------------------------------------
+
+/**
+ * Unevaluated sum hi + lo of two doubles, about 32 significant digits.
+ */
+struct SDoubleDouble
+{
+    double hi;
+    double lo;
+};
+
+SDoubleDouble MakeDoubleDouble(double value);
+SDoubleDouble operator+(const SDoubleDouble& a, const SDoubleDouble& b);
+SDoubleDouble operator-(const SDoubleDouble& a, const SDoubleDouble& b);
+SDoubleDouble operator*(const SDoubleDouble& a, const SDoubleDouble& b);
+
+/**
+ * Pixel (i, j) of a width x height frame shows the point
+ * center + (3 * (i / width - 0.5), 2 * (j / height - 0.5)) / zoom, so zoom 1
+ * is the [-1.5, 1.5] x [-1, 1] view of the float kernels.
+ */
+struct SDeepZoomView
+{
+    SDoubleDouble centerX;
+    SDoubleDouble centerY;
+    double zoom;
+};
+
+// Beyond this the double-double center can't tell neighbouring pixels apart
+const double kMaxDeepZoom = 1e28;
+
+/**
+ * Orbit of one starting point under z = z * z + seed, computed in double-double
+ * and stored rounded to double. It ends with the first point that escapes,
+ * or after maxIteration steps.
+ */
+class CReferenceOrbit
+{
+public:
+    void Compute(const SDoubleDouble& x, const SDoubleDouble& y,
+                 double seedX, double seedY, int maxIteration);
+    int GetLength() const;
+
+    std::vector<double> m_x;
+    std::vector<double> m_y;
+};
+
+/**
+ * Computes pixel (i, j) from @p reference, the orbit of the view center.
+ * Whenever the pixel's delta stops being small compared to its orbit (a
+ * glitch) or the reference runs out, it is rebased onto @p critical, the
+ * orbit of 0, and @p rebases is incremented.
+ */
+unsigned char PerturbedJuliaPixel(const SDeepZoomView& view, int width, int height,
+                                  const CReferenceOrbit& reference,
+                                  const CReferenceOrbit& critical, int maxIteration,
+                                  int i, int j, int& rebases);
+
+/**
+ * PerturbedJuliaPixel() for pixels x0, x0 + step, ... below x1 of one row.
+ * Returns the number of rebases.
+ */
+int PerturbedJuliaRow(const SDeepZoomView& view, int width, int height,
+                      const CReferenceOrbit& reference,
+                      const CReferenceOrbit& critical, int maxIteration,
+                      int row, int x0, int x1, int step, unsigned char* out);
+
+#endif // FRACTALDEEPZOOM_HPP
@@ -0,0 +1,772 @@
+#include "Stdafx.hpp"
+#include "FractalKernel.hpp"
+
+#include <QElapsedTimer>
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// MSVC accepts any intrinsic in any function, gcc and clang need the target
+// attribute on functions that use instructions beyond the build baseline.
+#if defined(_MSC_VER)
+#define FRACTAL_TARGET(isa)
+#else
+#define FRACTAL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// The kernels must not fuse multiply and add, or they would round differently
+// from the scalar loop.
+#if defined(_MSC_VER)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+// AVX-512 intrinsics are only available from VS2017.
+#if !defined(_MSC_VER) || _MSC_VER >= 1911
+#define FRACTAL_HAS_AVX512
+#endif
+
+namespace
+{
+
+    // Iteration counts are stored in 8 bits. Shallower tiers are stretched
+    // and deeper tiers compressed to 0..255, the 256 tier is stored as is.
+    template <int N>
+    struct SCountToByte
+    {
+        static_assert(N == 64 || N == 128 || N == 256 || N == 512 || N == 1024,
+                      "unsupported iteration depth");
+
+        static const int kLeftShift = N == 64 ? 2 : N == 128 ? 1 : 0;
+        static const int kRightShift = N == 1024 ? 2 : N == 512 ? 1 : 0;
+    };
+
+    // Maps pixel coordinates to the [-1.5, 1.5] x [-1, 1] plane. Every kernel
+    // must do exactly these float operations to stay bit-identical. The
+    // numerators are integers and negate exactly, so pixel w - i maps to -x
+    // bit for bit and the symmetric mode mirrors the same image.
+    inline float PixelToPlaneX(int i, int width)
+    {
+        return 3.0f * (2 * i - width) / (2.0f * width);
+    }
+
+    inline float PixelToPlaneY(int j, int height)
+    {
+        return 2.0f * (2 * j - height) / (2.0f * height);
+    }
+
+    inline int CountBits(unsigned int mask)
+    {
+        int bits = 0;
+        for (; mask; mask &= mask - 1)
+        {
+            ++bits;
+        }
+        return bits;
+    }
+
+    // Periodicity check (Brent): z is compared to a checkpoint taken at
+    // iterations 1, 2, 4, 8, ... If z lands exactly on the checkpoint the
+    // orbit is a cycle in float arithmetic and can never escape, so the pixel
+    // is interior. Exact equality keeps the result identical to running all
+    // N iterations, and every kernel uses the same checkpoints.
+    inline bool IsCheckpoint(int n)
+    {
+        return (n & (n + 1)) == 0;
+    }
+
+    template <int N>
+    unsigned char juliaSet(float x, float y, const float seedX, const float seedY,
+                           int& skipped)
+    {
+        float checkX = x;
+        float checkY = y;
+        int i;
+
+        for (i = 0; i < N; i++)
+        {
+            float tx = (x * x - y * y) + seedX;
+            float ty = (y * x + x * y) + seedY;
+
+            if ((tx * tx + ty * ty) > 4.0)
+            {
+                break;
+            }
+
+            x = tx;
+            y = ty;
+
+            if (x == checkX && y == checkY)
+            {
+                skipped += N - i - 1;
+                return 0;
+            }
+            if (IsCheckpoint(i))
+            {
+                checkX = x;
+                checkY = y;
+            }
+        }
+
+        return i == N ? 0 : static_cast<unsigned char>(
+            (i << SCountToByte<N>::kLeftShift) >> SCountToByte<N>::kRightShift);
+    }
+
+    template <int N>
+    int JuliaRowScalar(const SJuliaParam& param, int row, int x0, int x1,
+                       int step, unsigned char* out)
+    {
+        const float y = PixelToPlaneY(row, param.height);
+        int skipped = 0;
+
+        for (int i = x0; i < x1; i += step)
+        {
+            out[i] = juliaSet<N>(PixelToPlaneX(i, param.width), y,
+                                 param.seedX, param.seedY, skipped);
+        }
+        return skipped;
+    }
+
+    template <int N>
+    int JuliaPointsScalar(const SJuliaParam& param, const int* xs, const int* ys,
+                          int count, unsigned char* out)
+    {
+        int skipped = 0;
+
+        for (int k = 0; k < count; ++k)
+        {
+            out[k] = juliaSet<N>(PixelToPlaneX(xs[k], param.width),
+                                 PixelToPlaneY(ys[k], param.height),
+                                 param.seedX, param.seedY, skipped);
+        }
+        return skipped;
+    }
+
+    // ------------------------------------------------------------------------
+    // SSE2: 4 pixels per iteration
+    // ------------------------------------------------------------------------
+    template <int N>
+    __m128i JuliaSetSSE2(__m128 x, __m128 y, const __m128 seedX, const __m128 seedY,
+                         int& skipped)
+    {
+        const __m128 four = _mm_set1_ps(4.0f);
+        __m128 active = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        __m128 periodic = _mm_setzero_ps();
+        __m128i count = _mm_setzero_si128();
+        __m128 checkX = x;
+        __m128 checkY = y;
+
+        for (int n = 0; n < N; ++n)
+        {
+            __m128 tx = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), seedX);
+            __m128 ty = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, x), _mm_mul_ps(x, y)), seedY);
+            __m128 len = _mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty));
+
+            active = _mm_andnot_ps(_mm_cmpgt_ps(len, four), active);
+            if (_mm_movemask_ps(active) == 0)
+            {
+                break;
+            }
+
+            x = _mm_or_ps(_mm_and_ps(active, tx), _mm_andnot_ps(active, x));
+            y = _mm_or_ps(_mm_and_ps(active, ty), _mm_andnot_ps(active, y));
+            count = _mm_sub_epi32(count, _mm_castps_si128(active));
+
+            const __m128 cycle = _mm_and_ps(active, _mm_and_ps(_mm_cmpeq_ps(x, checkX),
+                                                               _mm_cmpeq_ps(y, checkY)));
+            if (_mm_movemask_ps(cycle) != 0)
+            {
+                skipped += CountBits(_mm_movemask_ps(cycle)) * (N - n - 1);
+                periodic = _mm_or_ps(periodic, cycle);
+                active = _mm_andnot_ps(cycle, active);
+                if (_mm_movemask_ps(active) == 0)
+                {
+                    break;
+                }
+            }
+            if (IsCheckpoint(n))
+            {
+                checkX = x;
+                checkY = y;
+            }
+        }
+
+        // lanes that never escaped are painted with 0
+        count = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(count, _mm_set1_epi32(N)),
+                                              _mm_castps_si128(periodic)), count);
+        return _mm_srli_epi32(_mm_slli_epi32(count, SCountToByte<N>::kLeftShift),
+                              SCountToByte<N>::kRightShift);
+    }
+
+    template <int N>
+    int JuliaRowSSE2(const SJuliaParam& param, int row, int x0, int x1,
+                     int step, unsigned char* out)
+    {
+        const __m128 width = _mm_set1_ps(static_cast<float>(param.width));
+        const __m128 twoWidth = _mm_set1_ps(2.0f * param.width);
+        const __m128 three = _mm_set1_ps(3.0f);
+        const __m128 seedX = _mm_set1_ps(param.seedX);
+        const __m128 seedY = _mm_set1_ps(param.seedY);
+        const __m128 y0 = _mm_set1_ps(PixelToPlaneY(row, param.height));
+        const __m128i lane = _mm_set_epi32(3 * step, 2 * step, step, 0);
+        int skipped = 0;
+
+        int i = x0;
+        for (; i + 3 * step < x1; i += 4 * step)
+        {
+            __m128 xs = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(i), lane));
+            __m128 x = _mm_div_ps(_mm_mul_ps(three, _mm_sub_ps(_mm_add_ps(xs, xs), width)),
+                                  twoWidth);
+            __m128i count = JuliaSetSSE2<N>(x, y0, seedX, seedY, skipped);
+
+            int result[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(result), count);
+            for (int k = 0; k < 4; ++k)
+            {
+                out[i + k * step] = static_cast<unsigned char>(result[k]);
+            }
+        }
+
+        return skipped + JuliaRowScalar<N>(param, row, i, x1, step, out);
+    }
+
+    template <int N>
+    int JuliaPointsSSE2(const SJuliaParam& param, const int* xs, const int* ys,
+                        int count, unsigned char* out)
+    {
+        const __m128 width = _mm_set1_ps(static_cast<float>(param.width));
+        const __m128 height = _mm_set1_ps(static_cast<float>(param.height));
+        const __m128 twoWidth = _mm_set1_ps(2.0f * param.width);
+        const __m128 twoHeight = _mm_set1_ps(2.0f * param.height);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 three = _mm_set1_ps(3.0f);
+        const __m128 seedX = _mm_set1_ps(param.seedX);
+        const __m128 seedY = _mm_set1_ps(param.seedY);
+        int skipped = 0;
+
+        int k = 0;
+        for (; k + 3 < count; k += 4)
+        {
+            __m128 px = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(xs + k)));
+            __m128 py = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ys + k)));
+            __m128 x = _mm_div_ps(_mm_mul_ps(three, _mm_sub_ps(_mm_add_ps(px, px), width)),
+                                  twoWidth);
+            __m128 y = _mm_div_ps(_mm_mul_ps(two, _mm_sub_ps(_mm_add_ps(py, py), height)),
+                                  twoHeight);
+            __m128i result = JuliaSetSSE2<N>(x, y, seedX, seedY, skipped);
+
+            result = _mm_packs_epi32(result, result);
+            result = _mm_packus_epi16(result, result);
+            const int bytes = _mm_cvtsi128_si32(result);
+            memcpy(out + k, &bytes, sizeof(bytes));
+        }
+
+        return skipped + JuliaPointsScalar<N>(param, xs + k, ys + k, count - k, out + k);
+    }
+
+    // ------------------------------------------------------------------------
+    // AVX2: 8 pixels per iteration
+    // ------------------------------------------------------------------------
+    template <int N>
+    FRACTAL_TARGET("avx2")
+    __m256i JuliaSetAVX2(__m256 x, __m256 y, const __m256 seedX, const __m256 seedY,
+                         int& skipped)
+    {
+        const __m256 four = _mm256_set1_ps(4.0f);
+        __m256 active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        __m256 periodic = _mm256_setzero_ps();
+        __m256i count = _mm256_setzero_si256();
+        __m256 checkX = x;
+        __m256 checkY = y;
+
+        for (int n = 0; n < N; ++n)
+        {
+            __m256 tx = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), seedX);
+            __m256 ty = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(y, x), _mm256_mul_ps(x, y)), seedY);
+            __m256 len = _mm256_add_ps(_mm256_mul_ps(tx, tx), _mm256_mul_ps(ty, ty));
+
+            active = _mm256_andnot_ps(_mm256_cmp_ps(len, four, _CMP_GT_OQ), active);
+            if (_mm256_movemask_ps(active) == 0)
+            {
+                break;
+            }
+
+            x = _mm256_blendv_ps(x, tx, active);
+            y = _mm256_blendv_ps(y, ty, active);
+            count = _mm256_sub_epi32(count, _mm256_castps_si256(active));
+
+            const __m256 cycle = _mm256_and_ps(active,
+                _mm256_and_ps(_mm256_cmp_ps(x, checkX, _CMP_EQ_OQ),
+                              _mm256_cmp_ps(y, checkY, _CMP_EQ_OQ)));
+            if (_mm256_movemask_ps(cycle) != 0)
+            {
+                skipped += CountBits(_mm256_movemask_ps(cycle)) * (N - n - 1);
+                periodic = _mm256_or_ps(periodic, cycle);
+                active = _mm256_andnot_ps(cycle, active);
+                if (_mm256_movemask_ps(active) == 0)
+                {
+                    break;
+                }
+            }
+            if (IsCheckpoint(n))
+            {
+                checkX = x;
+                checkY = y;
+            }
+        }
+
+        count = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi32(count, _mm256_set1_epi32(N)),
+                                                    _mm256_castps_si256(periodic)), count);
+        return _mm256_srli_epi32(_mm256_slli_epi32(count, SCountToByte<N>::kLeftShift),
+                                 SCountToByte<N>::kRightShift);
+    }
+
+    template <int N>
+    FRACTAL_TARGET("avx2")
+    int JuliaRowAVX2(const SJuliaParam& param, int row, int x0, int x1,
+                     int step, unsigned char* out)
+    {
+        const __m256 width = _mm256_set1_ps(static_cast<float>(param.width));
+        const __m256 twoWidth = _mm256_set1_ps(2.0f * param.width);
+        const __m256 three = _mm256_set1_ps(3.0f);
+        const __m256 seedX = _mm256_set1_ps(param.seedX);
+        const __m256 seedY = _mm256_set1_ps(param.seedY);
+        const __m256 y0 = _mm256_set1_ps(PixelToPlaneY(row, param.height));
+        const __m256i lane = _mm256_set_epi32(7 * step, 6 * step, 5 * step, 4 * step,
+                                              3 * step, 2 * step, step, 0);
+        int skipped = 0;
+
+        int i = x0;
+        for (; i + 7 * step < x1; i += 8 * step)
+        {
+            __m256 xs = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(i), lane));
+            __m256 x = _mm256_div_ps(_mm256_mul_ps(three, _mm256_sub_ps(_mm256_add_ps(xs, xs), width)),
+                                     twoWidth);
+            __m256i count = JuliaSetAVX2<N>(x, y0, seedX, seedY, skipped);
+
+            int result[8];
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(result), count);
+            for (int k = 0; k < 8; ++k)
+            {
+                out[i + k * step] = static_cast<unsigned char>(result[k]);
+            }
+        }
+
+        return skipped + JuliaRowSSE2<N>(param, row, i, x1, step, out);
+    }
+
+    template <int N>
+    FRACTAL_TARGET("avx2")
+    int JuliaPointsAVX2(const SJuliaParam& param, const int* xs, const int* ys,
+                        int count, unsigned char* out)
+    {
+        const __m256 width = _mm256_set1_ps(static_cast<float>(param.width));
+        const __m256 height = _mm256_set1_ps(static_cast<float>(param.height));
+        const __m256 twoWidth = _mm256_set1_ps(2.0f * param.width);
+        const __m256 twoHeight = _mm256_set1_ps(2.0f * param.height);
+        const __m256 two = _mm256_set1_ps(2.0f);
+        const __m256 three = _mm256_set1_ps(3.0f);
+        const __m256 seedX = _mm256_set1_ps(param.seedX);
+        const __m256 seedY = _mm256_set1_ps(param.seedY);
+        int skipped = 0;
+
+        int k = 0;
+        for (; k + 7 < count; k += 8)
+        {
+            __m256 px = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs + k)));
+            __m256 py = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys + k)));
+            __m256 x = _mm256_div_ps(_mm256_mul_ps(three, _mm256_sub_ps(_mm256_add_ps(px, px), width)),
+                                     twoWidth);
+            __m256 y = _mm256_div_ps(_mm256_mul_ps(two, _mm256_sub_ps(_mm256_add_ps(py, py), height)),
+                                     twoHeight);
+            __m256i result = JuliaSetAVX2<N>(x, y, seedX, seedY, skipped);
+
+            int values[8];
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(values), result);
+            for (int lane = 0; lane < 8; ++lane)
+            {
+                out[k + lane] = static_cast<unsigned char>(values[lane]);
+            }
+        }
+
+        return skipped + JuliaPointsSSE2<N>(param, xs + k, ys + k, count - k, out + k);
+    }
+
+    // ------------------------------------------------------------------------
+    // AVX-512: 16 pixels per iteration
+    // ------------------------------------------------------------------------
+#ifdef FRACTAL_HAS_AVX512
+    template <int N>
+    FRACTAL_TARGET("avx512f")
+    __m128i JuliaSetAVX512(__m512 x, __m512 y, const __m512 seedX, const __m512 seedY,
+                           int& skipped)
+    {
+        const __m512 four = _mm512_set1_ps(4.0f);
+        const __m512i one = _mm512_set1_epi32(1);
+        __mmask16 active = 0xFFFF;
+        __mmask16 periodic = 0;
+        __m512i count = _mm512_setzero_si512();
+        __m512 checkX = x;
+        __m512 checkY = y;
+
+        for (int n = 0; n < N; ++n)
+        {
+            __m512 tx = _mm512_add_ps(_mm512_sub_ps(_mm512_mul_ps(x, x), _mm512_mul_ps(y, y)), seedX);
+            __m512 ty = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(y, x), _mm512_mul_ps(x, y)), seedY);
+            __m512 len = _mm512_add_ps(_mm512_mul_ps(tx, tx), _mm512_mul_ps(ty, ty));
+
+            active = _mm512_mask_cmp_ps_mask(active, len, four, _CMP_NGT_UQ);
+            if (active == 0)
+            {
+                break;
+            }
+
+            x = _mm512_mask_blend_ps(active, x, tx);
+            y = _mm512_mask_blend_ps(active, y, ty);
+            count = _mm512_mask_add_epi32(count, active, count, one);
+
+            const __mmask16 cycle = _mm512_mask_cmp_ps_mask(active, x, checkX, _CMP_EQ_OQ) &
+                                    _mm512_cmp_ps_mask(y, checkY, _CMP_EQ_OQ);
+            if (cycle != 0)
+            {
+                skipped += CountBits(cycle) * (N - n - 1);
+                periodic |= cycle;
+                active &= ~cycle;
+                if (active == 0)
+                {
+                    break;
+                }
+            }
+            if (IsCheckpoint(n))
+            {
+                checkX = x;
+                checkY = y;
+            }
+        }
+
+        __mmask16 inside = _mm512_cmpeq_epi32_mask(count, _mm512_set1_epi32(N)) | periodic;
+        count = _mm512_mask_mov_epi32(count, inside, _mm512_setzero_si512());
+        count = _mm512_srli_epi32(_mm512_slli_epi32(count, SCountToByte<N>::kLeftShift),
+                                  SCountToByte<N>::kRightShift);
+        return _mm512_cvtepi32_epi8(count);
+    }
+
+    template <int N>
+    FRACTAL_TARGET("avx512f")
+    int JuliaRowAVX512(const SJuliaParam& param, int row, int x0, int x1,
+                       int step, unsigned char* out)
+    {
+        const __m512 width = _mm512_set1_ps(static_cast<float>(param.width));
+        const __m512 twoWidth = _mm512_set1_ps(2.0f * param.width);
+        const __m512 three = _mm512_set1_ps(3.0f);
+        const __m512 seedX = _mm512_set1_ps(param.seedX);
+        const __m512 seedY = _mm512_set1_ps(param.seedY);
+        const __m512 y0 = _mm512_set1_ps(PixelToPlaneY(row, param.height));
+        const __m512i lane = _mm512_set_epi32(15 * step, 14 * step, 13 * step, 12 * step,
+                                              11 * step, 10 * step, 9 * step, 8 * step,
+                                              7 * step, 6 * step, 5 * step, 4 * step,
+                                              3 * step, 2 * step, step, 0);
+        int skipped = 0;
+
+        int i = x0;
+        for (; i + 15 * step < x1; i += 16 * step)
+        {
+            __m512 xs = _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_set1_epi32(i), lane));
+            __m512 x = _mm512_div_ps(_mm512_mul_ps(three, _mm512_sub_ps(_mm512_add_ps(xs, xs), width)),
+                                     twoWidth);
+            const __m128i bytes = JuliaSetAVX512<N>(x, y0, seedX, seedY, skipped);
+            if (step == 1)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), bytes);
+            }
+            else
+            {
+                unsigned char result[16];
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(result), bytes);
+                for (int k = 0; k < 16; ++k)
+                {
+                    out[i + k * step] = result[k];
+                }
+            }
+        }
+
+        return skipped + JuliaRowAVX2<N>(param, row, i, x1, step, out);
+    }
+
+    template <int N>
+    FRACTAL_TARGET("avx512f")
+    int JuliaPointsAVX512(const SJuliaParam& param, const int* xs, const int* ys,
+                          int count, unsigned char* out)
+    {
+        const __m512 width = _mm512_set1_ps(static_cast<float>(param.width));
+        const __m512 height = _mm512_set1_ps(static_cast<float>(param.height));
+        const __m512 twoWidth = _mm512_set1_ps(2.0f * param.width);
+        const __m512 twoHeight = _mm512_set1_ps(2.0f * param.height);
+        const __m512 two = _mm512_set1_ps(2.0f);
+        const __m512 three = _mm512_set1_ps(3.0f);
+        const __m512 seedX = _mm512_set1_ps(param.seedX);
+        const __m512 seedY = _mm512_set1_ps(param.seedY);
+        int skipped = 0;
+
+        int k = 0;
+        for (; k + 15 < count; k += 16)
+        {
+            __m512 px = _mm512_cvtepi32_ps(_mm512_loadu_si512(xs + k));
+            __m512 py = _mm512_cvtepi32_ps(_mm512_loadu_si512(ys + k));
+            __m512 x = _mm512_div_ps(_mm512_mul_ps(three, _mm512_sub_ps(_mm512_add_ps(px, px), width)),
+                                     twoWidth);
+            __m512 y = _mm512_div_ps(_mm512_mul_ps(two, _mm512_sub_ps(_mm512_add_ps(py, py), height)),
+                                     twoHeight);
+            const __m128i bytes = JuliaSetAVX512<N>(x, y, seedX, seedY, skipped);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), bytes);
+        }
+
+        return skipped + JuliaPointsAVX2<N>(param, xs + k, ys + k, count - k, out + k);
+    }
+#endif
+
+    bool CPUID(int leaf, int subleaf, unsigned int regs[4])
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < leaf)
+            return false;
+
+        __cpuidex(info, leaf, subleaf);
+        for (int k = 0; k < 4; ++k)
+            regs[k] = static_cast<unsigned int>(info[k]);
+        return true;
+#else
+        if (static_cast<int>(__get_cpuid_max(0, nullptr)) < leaf)
+            return false;
+
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+        return true;
+#endif
+    }
+
+    template <int N>
+    JuliaRowFunc GetJuliaRowFuncOfDepth(FRACTAL_ISA isa)
+    {
+        switch (isa)
+        {
+        case ISA_SCALAR:
+            return JuliaRowScalar<N>;
+        case ISA_SSE2:
+            return JuliaRowSSE2<N>;
+        case ISA_AVX2:
+            return JuliaRowAVX2<N>;
+#ifdef FRACTAL_HAS_AVX512
+        case ISA_AVX512:
+            return JuliaRowAVX512<N>;
+#endif
+        default:
+            return nullptr;
+        }
+    }
+
+    template <int N>
+    JuliaPointsFunc GetJuliaPointsFuncOfDepth(FRACTAL_ISA isa)
+    {
+        switch (isa)
+        {
+        case ISA_SCALAR:
+            return JuliaPointsScalar<N>;
+        case ISA_SSE2:
+            return JuliaPointsSSE2<N>;
+        case ISA_AVX2:
+            return JuliaPointsAVX2<N>;
+#ifdef FRACTAL_HAS_AVX512
+        case ISA_AVX512:
+            return JuliaPointsAVX512<N>;
+#endif
+        default:
+            return nullptr;
+        }
+    }
+
+    // Which register states the OS saves on context switch
+    unsigned long long XGETBV()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+    }
+
+    FRACTAL_ISA DetectOnce()
+    {
+        unsigned int regs[4] = { 0 };
+        FRACTAL_ISA detected = ISA_SCALAR;
+
+        if (! CPUID(1, 0, regs))
+            return detected;
+
+        if (regs[3] & (1u << 26))
+            detected = ISA_SSE2;
+
+        const bool osxsave = (regs[2] & (1u << 27)) != 0;
+        const bool avx = (regs[2] & (1u << 28)) != 0;
+        if (! osxsave || ! avx)
+            return detected;
+
+        const unsigned long long xcr0 = XGETBV();
+        // XMM and YMM state
+        if ((xcr0 & 0x6) != 0x6)
+            return detected;
+
+        if (! CPUID(7, 0, regs))
+            return detected;
+
+        if (regs[1] & (1u << 5))
+            detected = ISA_AVX2;
+
+        // opmask, upper ZMM0-15 and ZMM16-31 state
+        if ((regs[1] & (1u << 16)) && (xcr0 & 0xE0) == 0xE0 &&
+            GetJuliaRowFunc(ISA_AVX512) != nullptr)
+        {
+            detected = ISA_AVX512;
+        }
+
+        return detected;
+    }
+
+}
+
+FRACTAL_ISA DetectFractalISA()
+{
+    // Tile threads may ask at the same time. The static is initialised once,
+    // the CFractal constructor asks first, before any tile runs.
+    static const FRACTAL_ISA detected = DetectOnce();
+    return detected;
+}
+
+bool IsFractalISASupported(FRACTAL_ISA isa)
+{
+    return isa <= DetectFractalISA() && GetJuliaRowFunc(isa) != nullptr;
+}
+
+const char* GetFractalISAName(FRACTAL_ISA isa)
+{
+    switch (isa)
+    {
+    case ISA_SCALAR:
+        return "scalar";
+    case ISA_SSE2:
+        return "SSE2";
+    case ISA_AVX2:
+        return "AVX2";
+    case ISA_AVX512:
+        return "AVX-512";
+    default:
+        return "unknown";
+    }
+}
+
+JuliaPointsFunc GetJuliaPointsFunc(FRACTAL_ISA isa, FRACTAL_DEPTH depth)
+{
+    switch (depth)
+    {
+    case DEPTH_64:
+        return GetJuliaPointsFuncOfDepth<64>(isa);
+    case DEPTH_128:
+        return GetJuliaPointsFuncOfDepth<128>(isa);
+    case DEPTH_256:
+        return GetJuliaPointsFuncOfDepth<256>(isa);
+    case DEPTH_512:
+        return GetJuliaPointsFuncOfDepth<512>(isa);
+    case DEPTH_1024:
+        return GetJuliaPointsFuncOfDepth<1024>(isa);
+    default:
+        return nullptr;
+    }
+}
+
+int GetFractalDepthIteration(FRACTAL_DEPTH depth)
+{
+    return 64 << depth;
+}
+
+JuliaRowFunc GetJuliaRowFunc(FRACTAL_ISA isa, FRACTAL_DEPTH depth)
+{
+    switch (depth)
+    {
+    case DEPTH_64:
+        return GetJuliaRowFuncOfDepth<64>(isa);
+    case DEPTH_128:
+        return GetJuliaRowFuncOfDepth<128>(isa);
+    case DEPTH_256:
+        return GetJuliaRowFuncOfDepth<256>(isa);
+    case DEPTH_512:
+        return GetJuliaRowFuncOfDepth<512>(isa);
+    case DEPTH_1024:
+        return GetJuliaRowFuncOfDepth<1024>(isa);
+    default:
+        return nullptr;
+    }
+}
+
+void BenchmarkJuliaKernels(std::ostream& out, int width, int height,
+                           float seedX, float seedY)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    const size_t size = static_cast<size_t>(width) * height;
+    const SJuliaParam param = { width, height, seedX, seedY };
+
+    std::unique_ptr<unsigned char[]> reference(new unsigned char[size]);
+    std::unique_ptr<unsigned char[]> result(new unsigned char[size]);
+
+    out << "Julia kernel benchmark " << width << "x" << height
+        << ", seed (" << seedX << ", " << seedY << ")" << std::endl;
+
+    qint64 scalarNs = 0;
+    for (int isa = ISA_SCALAR; isa < ISA_TOTAL; ++isa)
+    {
+        const FRACTAL_ISA id = static_cast<FRACTAL_ISA>(isa);
+        if (! IsFractalISASupported(id))
+        {
+            out << "  " << GetFractalISAName(id) << ": not supported" << std::endl;
+            continue;
+        }
+
+        JuliaRowFunc func = GetJuliaRowFunc(id);
+        unsigned char* data = id == ISA_SCALAR ? reference.get() : result.get();
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int j = 0; j < height; ++j)
+        {
+            func(param, j, 0, width, 1, data + j * width);
+        }
+        const qint64 ns = timer.nsecsElapsed();
+
+        out << "  " << GetFractalISAName(id) << ": " << ns / 1000000.0 << " ms";
+        if (id == ISA_SCALAR)
+        {
+            scalarNs = ns;
+        }
+        else
+        {
+            out << ", speedup " << static_cast<double>(scalarNs) / (ns ? ns : 1) << "x"
+                << (memcmp(reference.get(), data, size) == 0 ? ", bit-identical" : ", MISMATCH");
+        }
+        out << std::endl;
+    }
+}
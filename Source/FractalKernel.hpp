@@ -0,0 +1,79 @@
+#ifndef FRACTALKERNEL_HPP
+#define FRACTALKERNEL_HPP
+
+#include <iosfwd>
+
+// ----------------------------------------------------------------------------
+// Julia set kernels, one per instruction set. All kernels produce exactly the
+// same 8-bit iteration counts as the scalar reference.
+// ----------------------------------------------------------------------------
+enum FRACTAL_ISA
+{
+    ISA_SCALAR = 0,
+    ISA_SSE2,
+    ISA_AVX2,
+    ISA_AVX512,
+    ISA_TOTAL
+};
+
+/**
+ * Iteration limit tiers, each compiled into its own set of kernels. Every
+ * tier scales its counts to the full 0..255 output range.
+ */
+enum FRACTAL_DEPTH
+{
+    DEPTH_64 = 0,
+    DEPTH_128,
+    DEPTH_256,
+    DEPTH_512,
+    DEPTH_1024,
+    DEPTH_TOTAL
+};
+
+int GetFractalDepthIteration(FRACTAL_DEPTH depth);
+
+struct SJuliaParam
+{
+    int width;
+    int height;
+    float seedX;
+    float seedY;
+};
+
+/**
+ * Computes pixels x0, x0 + step, ... below x1 of one row and leaves the others
+ * untouched. @p out points to the start of the row. Returns the iterations
+ * skipped because an orbit was found to be periodic.
+ */
+typedef int (*JuliaRowFunc)(const SJuliaParam& param, int row, int x0, int x1,
+                            int step, unsigned char* out);
+
+/**
+ * Computes @p count pixels at arbitrary positions (xs[k], ys[k]) into out[k],
+ * with the same results as the row kernel. Returns the skipped iterations.
+ */
+typedef int (*JuliaPointsFunc)(const SJuliaParam& param, const int* xs,
+                               const int* ys, int count, unsigned char* out);
+
+/**
+ * Returns the widest instruction set supported by both the CPU and the OS.
+ */
+FRACTAL_ISA DetectFractalISA();
+bool IsFractalISASupported(FRACTAL_ISA isa);
+const char* GetFractalISAName(FRACTAL_ISA isa);
+
+/**
+ * Returns the kernel of @p isa and @p depth, or nullptr if it was not
+ * compiled in.
+ */
+JuliaRowFunc GetJuliaRowFunc(FRACTAL_ISA isa, FRACTAL_DEPTH depth = DEPTH_256);
+JuliaPointsFunc GetJuliaPointsFunc(FRACTAL_ISA isa, FRACTAL_DEPTH depth = DEPTH_256);
+
+/**
+ * Times every supported kernel on a width x height frame, checks its output
+ * against the scalar kernel, and prints the result to @p out.
+ */
+void BenchmarkJuliaKernels(std::ostream& out, int width, int height,
+                           float seedX, float seedY);
+
+#endif // FRACTALKERNEL_HPP
@@ -0,0 +1,228 @@
+#include "Stdafx.hpp"
+#include "FramePool.hpp"
+#include <stdexcept>
+#include <utility>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+    // Slabs are whole pages, which also makes them cache line aligned
+    const size_t kPageSize = 4096;
+    // room to grow of a new slab, as a share of the requested size
+    const size_t kGrowthDivisor = 8;
+    // idle slabs above this are returned to the OS, oldest first
+    const unsigned long long kMaxIdleBytes = 128ULL * 1024 * 1024;
+
+    size_t RoundUpToPage(size_t size)
+    {
+        return (size + kPageSize - 1) / kPageSize * kPageSize;
+    }
+
+    // Pages from the OS are zero and only committed on first touch
+    unsigned char* AllocateFromOS(size_t capacity)
+    {
+#if defined(_WIN32)
+        void* data = VirtualAlloc(nullptr, capacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        void* data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED)
+            data = nullptr;
+#endif
+        if (data == nullptr)
+        {
+            throw std::runtime_error("CFramePool: out of memory");
+        }
+        return static_cast<unsigned char*>(data);
+    }
+
+    void FreeToOS(unsigned char* data, size_t capacity)
+    {
+#if defined(_WIN32)
+        (void)capacity;
+        VirtualFree(data, 0, MEM_RELEASE);
+#else
+        munmap(data, capacity);
+#endif
+    }
+}
+
+// -----------------------------------------------------------------------------
+// CFrameSlab Functions
+// -----------------------------------------------------------------------------
+CFrameSlab::CFrameSlab() : m_data(nullptr), m_capacity(0), m_zero(false)
+{
+}
+
+CFrameSlab::CFrameSlab(CFrameSlab&& other) : m_data(other.m_data),
+                                             m_capacity(other.m_capacity),
+                                             m_zero(other.m_zero)
+{
+    other.m_data = nullptr;
+    other.m_capacity = 0;
+    other.m_zero = false;
+}
+
+CFrameSlab& CFrameSlab::operator=(CFrameSlab&& other)
+{
+    if (this != &other)
+    {
+        Reset();
+        Swap(other);
+    }
+    return *this;
+}
+
+CFrameSlab::~CFrameSlab()
+{
+    Reset();
+}
+
+unsigned char* CFrameSlab::GetData() const
+{
+    // the caller may write through the pointer from now on
+    if (m_zero)
+        m_zero = false;
+    return m_data;
+}
+
+size_t CFrameSlab::GetCapacity() const
+{
+    return m_capacity;
+}
+
+bool CFrameSlab::IsZero() const
+{
+    return m_zero;
+}
+
+void CFrameSlab::Swap(CFrameSlab& other)
+{
+    std::swap(m_data, other.m_data);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_zero, other.m_zero);
+}
+
+void CFrameSlab::Reset()
+{
+    if (m_data)
+    {
+        CFramePool::GetInstance().Release(m_data, m_capacity);
+    }
+    m_data = nullptr;
+    m_capacity = 0;
+    m_zero = false;
+}
+
+// -----------------------------------------------------------------------------
+// CFramePool Functions
+// -----------------------------------------------------------------------------
+CFramePool CFramePool::s_instance;
+
+CFramePool::CFramePool()
+{
+    m_stats.hits = 0;
+    m_stats.misses = 0;
+    m_stats.bytesResident = 0;
+    m_stats.bytesIdle = 0;
+}
+
+CFramePool::~CFramePool()
+{
+    Trim();
+}
+
+CFramePool& CFramePool::GetInstance()
+{
+    return s_instance;
+}
+
+CFrameSlab CFramePool::Acquire(size_t size)
+{
+    CFrameSlab slab;
+    if (size == 0)
+    {
+        return slab;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+
+        // best fit among the idle slabs which don't waste more than half
+        size_t best = m_idle.size();
+        for (size_t i = 0; i < m_idle.size(); ++i)
+        {
+            const size_t capacity = m_idle[i].capacity;
+            if (capacity >= size && capacity / 2 <= size &&
+                (best == m_idle.size() || capacity < m_idle[best].capacity))
+            {
+                best = i;
+            }
+        }
+
+        if (best != m_idle.size())
+        {
+            slab.m_data = m_idle[best].data;
+            slab.m_capacity = m_idle[best].capacity;
+            m_stats.bytesIdle -= slab.m_capacity;
+            m_stats.hits++;
+            m_idle.erase(m_idle.begin() + best);
+            return slab;
+        }
+
+        m_stats.misses++;
+    }
+
+    const size_t capacity = RoundUpToPage(size + size / kGrowthDivisor);
+    slab.m_data = AllocateFromOS(capacity);
+    slab.m_capacity = capacity;
+    slab.m_zero = true;
+
+    QMutexLocker locker(&m_mutex);
+    m_stats.bytesResident += capacity;
+    return slab;
+}
+
+void CFramePool::Release(unsigned char* data, size_t capacity)
+{
+    QMutexLocker locker(&m_mutex);
+
+    const SIdleSlab idle = { data, capacity };
+    m_idle.push_back(idle);
+    m_stats.bytesIdle += capacity;
+
+    while (m_stats.bytesIdle > kMaxIdleBytes)
+    {
+        FreeIdleSlab(0);
+    }
+}
+
+void CFramePool::FreeIdleSlab(size_t index)
+{
+    const SIdleSlab idle = m_idle[index];
+    m_idle.erase(m_idle.begin() + index);
+    m_stats.bytesIdle -= idle.capacity;
+    m_stats.bytesResident -= idle.capacity;
+    FreeToOS(idle.data, idle.capacity);
+}
+
+void CFramePool::Trim()
+{
+    QMutexLocker locker(&m_mutex);
+
+    while (! m_idle.empty())
+    {
+        FreeIdleSlab(m_idle.size() - 1);
+    }
+}
+
+SFramePoolStats CFramePool::GetStats() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_stats;
+}
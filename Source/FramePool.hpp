@@ -0,0 +1,94 @@
+#ifndef FRAMEPOOL_HPP
+#define FRAMEPOOL_HPP
+
+#include <QMutex>
+#include <cstddef>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Frame storage for all buffers. Slabs are page aligned and come straight
+// from the OS, so they start out zero. Slabs given back on a resize or buffer
+// mode switch are kept and handed out again.
+// ----------------------------------------------------------------------------
+
+struct SFramePoolStats
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    // slabs in use plus idle slabs
+    unsigned long long bytesResident;
+    unsigned long long bytesIdle;
+};
+
+/**
+ * One slab, owned by a buffer and given back to the pool on destruction.
+ * A slab fresh from the OS is known to be zero until GetData() is called
+ * for the first time.
+ */
+class CFrameSlab
+{
+public:
+    CFrameSlab();
+    CFrameSlab(CFrameSlab&& other);
+    CFrameSlab& operator=(CFrameSlab&& other);
+    ~CFrameSlab();
+
+    unsigned char* GetData() const;
+    size_t GetCapacity() const;
+    bool IsZero() const;
+    void Swap(CFrameSlab& other);
+    // Gives the slab back to the pool
+    void Reset();
+
+private:
+    CFrameSlab(const CFrameSlab&) = delete;
+    CFrameSlab& operator=(const CFrameSlab&) = delete;
+
+    unsigned char* m_data;
+    size_t m_capacity;
+    mutable bool m_zero;
+
+    friend class CFramePool;
+};
+
+class CFramePool
+{
+public:
+    static CFramePool& GetInstance();
+
+    /**
+     * Returns a slab of at least @p size bytes. An idle slab is reused if it
+     * is not more than twice as large, otherwise a new one with some room to
+     * grow is allocated, so a window growing in small steps keeps its slabs.
+     */
+    CFrameSlab Acquire(size_t size);
+    // Returns all idle slabs to the OS
+    void Trim();
+    SFramePoolStats GetStats() const;
+
+private:
+    CFramePool();
+    ~CFramePool();
+    CFramePool(const CFramePool&) = delete;
+    CFramePool& operator=(const CFramePool&) = delete;
+
+    void Release(unsigned char* data, size_t capacity);
+    void FreeIdleSlab(size_t index);
+
+    struct SIdleSlab
+    {
+        unsigned char* data;
+        size_t capacity;
+    };
+
+    static CFramePool s_instance;
+
+    mutable QMutex m_mutex;
+    // oldest first, the oldest ones go when the pool holds too much
+    std::vector<SIdleSlab> m_idle;
+    SFramePoolStats m_stats;
+
+    friend class CFrameSlab;
+};
+
+#endif // FRAMEPOOL_HPP
@@ -3,23 +3,39 @@
 #include "Worker.hpp"
 #include "FFmpegPlayer.hpp"     // CFFmpeg::initFFmpeg
 #include "Fractal.hpp"
+#include "ThreadPlacement.hpp"
 
 #include <QOpenGLBuffer>
 #include <QOpenGLShaderProgram>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
 
 QOpenGLFunctions* CGLWidget::m_glProvider = nullptr;
 
+namespace
+{
+    // enough to hide a few slow frames, e.g. video I-frames
+    const int kDefaultRingDepth = 4;
+
+    // Pauses per worker of the cancel latency check. The pauses come 1 to
+    // kCancelCheckSpreadMs apart, so they hit the frames at different points.
+    const int kCancelCheckRounds = 50;
+    const int kCancelCheckSpreadMs = 7;
+}
+
 CGLWidget::CGLWidget(QWidget* parent, QGLWidget* shareWidget): QGLWidget(parent, shareWidget),
                                                                m_lookupTexture(0),
                                                                m_vertexBuffer(nullptr),
                                                                m_threadMode(false), m_bufferMode(BF_SINGLE),
-                                                               m_timeStamp(0)
+                                                               m_ringDepth(kDefaultRingDepth),
+                                                               m_timeStamp(0), m_placementId(-1)
 {
 }
 
 CGLWidget::~CGLWidget()
 {
-    std::for_each(m_threads.begin(), m_threads.end(),
+    std::for_each(m_workers.begin(), m_workers.end(),
         [](CWorker* t) {
             t->Stop();
             delete t;
@@ -33,7 +49,7 @@ CGLWidget::PauseWorkers::PauseWorkers(CGLWidget* widget) : m_widget(widget)
 {
     if (m_widget->m_threadMode)
     {
-        for (auto& worker : m_widget->m_threads)
+        for (auto& worker : m_widget->m_workers)
         {
             worker->Pause();
         }
@@ -44,7 +60,7 @@ CGLWidget::PauseWorkers::~PauseWorkers()
 {
     if (m_widget->m_threadMode)
     {
-        for (auto& worker : m_widget->m_threads)
+        for (auto& worker : m_widget->m_workers)
         {
             worker->Resume(true);
         }
@@ -67,7 +83,7 @@ void CGLWidget::ChangeBufferMode(BUFFER_MODE mode)
 
         for (auto& texObj : m_threadTextures)
         {
-            texObj->CopyWorkerDataToMe();
+            texObj->MoveWorkerDataToMe();
         }
     }
     else
@@ -79,6 +95,9 @@ void CGLWidget::ChangeBufferMode(BUFFER_MODE mode)
             if (mode == BF_DOUBLE) {
                 texObj->GetWorker()->UseDoubleBuffer();
             }
+            else if (mode == BF_RING) {
+                texObj->GetWorker()->UseRingBuffer(m_ringDepth);
+            }
             else {
                 texObj->GetWorker()->UseTripleBuffer();
             }
@@ -88,12 +107,44 @@ void CGLWidget::ChangeBufferMode(BUFFER_MODE mode)
         {
             for (auto& texObj : m_threadTextures)
             {
-                texObj->CopyMyDataToWorker();
+                texObj->MoveMyDataToWorker();
             }
         }
     }
 }
 
+CGLWidget::BUFFER_MODE CGLWidget::GetBufferMode() const
+{
+    return m_bufferMode;
+}
+
+void CGLWidget::ChangeHandoffPolicy(HANDOFF_POLICY policy)
+{
+    PauseWorkers pauseWorkers(this);
+
+    for (auto& worker : m_workers)
+    {
+        worker->SetHandoffPolicy(policy);
+    }
+}
+
+void CGLWidget::ChangeRingBufferDepth(int depth)
+{
+    if (m_ringDepth == depth)
+        return;
+
+    m_ringDepth = depth;
+    if (m_bufferMode != BF_RING)
+        return;
+
+    PauseWorkers pauseWorkers(this);
+
+    for (auto& texObj : m_threadTextures)
+    {
+        texObj->GetWorker()->UseRingBuffer(m_ringDepth);
+    }
+}
+
 void CGLWidget::initializeGL()
 {
     initializeOpenGLFunctions();
@@ -106,6 +157,9 @@ void CGLWidget::initializeGL()
 
     CGLWidget::m_glProvider = this;
 
+    // before the executor threads are started from here
+    m_placementId = CThreadPlacement::GetInstance().PlaceCurrentThread(ROLE_RENDER, "render");
+
     QImage image(":/CMainWindow/Resources/lookup.png");
     m_lookupTexture = bindTexture(image);
 
@@ -115,13 +169,13 @@ void CGLWidget::initializeGL()
     float data[8] = {1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f};
     m_vertexBuffer->allocate(data, sizeof(data));
 
-    m_threads.push_back(new CWorker);
-    m_threads.push_back(new CWorker);
+    m_workers.push_back(new CWorker);
+    m_workers.push_back(new CWorker);
 
-    std::for_each(m_threads.begin(), m_threads.end(),
+    // the workers run their frames on the shared executor once resumed
+    std::for_each(m_workers.begin(), m_workers.end(),
         [](CWorker* w) {
             w->UseTripleBuffer();
-            w->start();
         });
 
     // initialize texture objects
@@ -134,11 +188,14 @@ void CGLWidget::initializeGL()
 
     m_fractalTex.SetTextureFormat(GL_RED, GL_R8);
     m_fractalTex.SetAnimated(false);
+    m_fractalTex.SetProgressive(true);
+    // keep the fractal at 30 fps or better, trading iteration depth for it
+    m_fractalTex.SetFrameBudget(33);
     m_fractalTex.SetSeedPoint(QPointF(-0.372867, 0.602788));
 
     // bind texture objects and worker
-    m_threads[0]->BindTextureObject(&m_videoTex);
-    m_threads[1]->BindTextureObject(&m_fractalTex);
+    m_workers[0]->BindTextureObject(&m_videoTex);
+    m_workers[1]->BindTextureObject(&m_fractalTex);
     m_threadTextures.push_back(&m_videoTex);
     m_threadTextures.push_back(&m_fractalTex);
 
@@ -159,11 +216,6 @@ void CGLWidget::initializeGL()
     }
     m_basefx.Disable();
 
-    std::for_each(m_threads.begin(), m_threads.end(),
-        [](CWorker* t) {
-            t->Pause();
-        });
-
     setMouseTracking(true);
     m_timeStamp = QTime::currentTime().msecsSinceStartOfDay();
 }
@@ -172,14 +224,14 @@ void CGLWidget::resizeGL(const int width, const int height)
 {
     glViewport(0, 0, width, height);
 
-    {
-        PauseWorkers pauseWorkers(this);
-
-        std::for_each(m_threadTextures.begin(), m_threadTextures.end(),
-            [this, width, height](CTextureObject* texObj) {
-                texObj->Resize(width, height);
-            });
-    }
+    // The workers keep running and switch to the new size with their next
+    // frame. A frame in progress is cut short so that happens soon.
+    std::for_each(m_threadTextures.begin(), m_threadTextures.end(),
+        [this, width, height](CTextureObject* texObj) {
+            texObj->RequestResize(width, height);
+            if (m_threadMode)
+                texObj->StopUpdate();
+        });
 
     DestroyTextureRenderTarget();
     CreateTextureRenderTarget(width, height);
@@ -203,6 +255,7 @@ void CGLWidget::paintGL()
 
     int currentMs = QTime::currentTime().msecsSinceStartOfDay();
     int elapsedMs = currentMs - m_timeStamp;
+    CThreadPlacement::GetInstance().SampleThread(m_placementId);
 
     const CBuffer* updatedBuf = nullptr;
     if (m_threadMode)
@@ -290,10 +343,8 @@ void CGLWidget::NewVideo(const char* filename)
 
     m_videoTex.ChangeVideo(filename);
 
-    // twice resize because if the width and height equal to original value,
-    // we don't resize, so we resize twice to trigger it perform real resize
-    m_videoTex.Resize(4, 4);
-    m_videoTex.Resize(width(), height());
+    // the frames of the old movie are of no use, whatever their size
+    m_videoTex.ResetFrames(width(), height());
 
     if (m_threadMode)
         m_videoTex.GetWorker()->Resume(true);
@@ -314,6 +365,193 @@ void CGLWidget::ChangeFluidMaxHeight(int value)
     m_fluidfx.WindowResize(width(), height());
 }
 
+const SUpdateStats& CGLWidget::GetVideoUpdateStats() const
+{
+    return m_videoTex.GetUpdateStats();
+}
+
+const SUpdateStats& CGLWidget::GetFractalUpdateStats() const
+{
+    return m_fractalTex.GetUpdateStats();
+}
+
+FRAME_LAYOUT CGLWidget::GetVideoFrameLayout() const
+{
+    return m_videoTex.GetFrameLayout();
+}
+
+void CGLWidget::GetVideoFrameSize(int& width, int& height) const
+{
+    m_videoTex.GetRequestedSize(width, height);
+}
+
+SConvertStats CGLWidget::GetVideoConvertStats() const
+{
+    return m_videoTex.GetConvertStats();
+}
+
+SPipelineStats CGLWidget::GetVideoPipelineStats() const
+{
+    return m_videoTex.GetPipelineStats();
+}
+
+const SHandoffStats& CGLWidget::GetFractalHandoffStats() const
+{
+    return m_fractalTex.GetWorker()->GetHandoffStats();
+}
+
+SFrameMemory CGLWidget::GetVideoFrameMemory() const
+{
+    return m_videoTex.GetFrameMemory();
+}
+
+SFrameMemory CGLWidget::GetFractalFrameMemory() const
+{
+    return m_fractalTex.GetFrameMemory();
+}
+
+const SResizeStats& CGLWidget::GetVideoResizeStats() const
+{
+    return m_videoTex.GetResizeStats();
+}
+
+const SResizeStats& CGLWidget::GetFractalResizeStats() const
+{
+    return m_fractalTex.GetResizeStats();
+}
+
+const SDeadlineStats& CGLWidget::GetVideoDeadlineStats() const
+{
+    return m_videoTex.GetWorker()->GetDeadlineStats();
+}
+
+const SDeadlineStats& CGLWidget::GetFractalDeadlineStats() const
+{
+    return m_fractalTex.GetWorker()->GetDeadlineStats();
+}
+
+const SCancelStats& CGLWidget::GetVideoCancelStats() const
+{
+    return m_videoTex.GetWorker()->GetCancelStats();
+}
+
+const SCancelStats& CGLWidget::GetFractalCancelStats() const
+{
+    return m_fractalTex.GetWorker()->GetCancelStats();
+}
+
+const CFractal& CGLWidget::GetFractal() const
+{
+    return m_fractalTex;
+}
+
+void CGLWidget::BenchmarkFractal()
+{
+    PauseWorkers pauseWorkers(this);
+    m_fractalTex.BenchmarkKernels(width(), height());
+}
+
+void CGLWidget::BenchmarkDecode()
+{
+    PauseWorkers pauseWorkers(this);
+
+    const QFileInfo current(QString::fromStdString(m_videoTex.GetFileName()));
+    const QDir dir = current.absoluteDir();
+    for (const QString& name : dir.entryList(QDir::Files, QDir::Name))
+    {
+        const std::string fileName = dir.filePath(name).toStdString();
+        try
+        {
+            CFFmpegPlayer::benchmarkDecode(std::cout, fileName, QThread::idealThreadCount());
+        }
+        catch (std::runtime_error&)
+        {
+            std::cout << "Decode benchmark: " << fileName << " is no movie" << std::endl;
+        }
+    }
+}
+
+bool CGLWidget::CheckCancelLatency()
+{
+    std::cout << "Cancel latency check, budget " << kMaxCancelLatencyUs << " us" << std::endl;
+    if (! m_threadMode)
+    {
+        std::cout << "  the workers don't run" << std::endl;
+        return true;
+    }
+
+    const std::pair<const char*, CWorker*> workers[] =
+    {
+        std::make_pair("video", m_videoTex.GetWorker()),
+        std::make_pair("fractal", m_fractalTex.GetWorker())
+    };
+
+    bool passed = true;
+    for (const auto& worker : workers)
+    {
+        // A pause of an idle worker says nothing about the budget, only the
+        // ones which found a frame in progress count
+        const SCancelStats& stats = worker.second->GetCancelStats();
+        int hits = 0;
+        qint64 maxLatencyUs = 0;
+        for (int i = 0; i < kCancelCheckRounds; ++i)
+        {
+            QThread::msleep(1 + i % kCancelCheckSpreadMs);
+            const unsigned long long cancelledFrames = stats.cancelledFrames;
+            worker.second->Pause();
+            if (stats.cancelledFrames != cancelledFrames)
+            {
+                ++hits;
+                maxLatencyUs = std::max(maxLatencyUs, stats.lastLatencyUs);
+            }
+            worker.second->Resume(true);
+        }
+
+        const bool withinBudget = hits > 0 && maxLatencyUs <= kMaxCancelLatencyUs;
+        passed = passed && withinBudget;
+        std::cout << "  " << worker.first << ": " << hits << " of " << kCancelCheckRounds
+                  << " pauses hit a frame";
+        if (hits > 0)
+            std::cout << ", longest " << maxLatencyUs << " us";
+        std::cout << ", " << (withinBudget ? "ok" : "FAILED") << std::endl;
+    }
+    return passed;
+}
+
+void CGLWidget::ToggleVideoYuv()
+{
+    PauseWorkers pauseWorkers(this);
+
+    m_videoTex.ChangeFrameLayout(m_videoTex.GetFrameLayout() == LAYOUT_YUV420 ? LAYOUT_PACKED
+                                                                              : LAYOUT_YUV420);
+
+    m_videoTex.ResetFrames(width(), height());
+}
+
+void CGLWidget::ToggleVideoNativeSize()
+{
+    PauseWorkers pauseWorkers(this);
+
+    m_videoTex.SetNativeSize(! m_videoTex.IsNativeSize());
+    m_videoTex.ResetFrames(width(), height());
+}
+
+void CGLWidget::ToggleSubdivision()
+{
+    m_fractalTex.SetSubdivision(! m_fractalTex.IsSubdivision());
+}
+
+void CGLWidget::ToggleSymmetry()
+{
+    m_fractalTex.SetSymmetric(! m_fractalTex.IsSymmetric());
+}
+
+void CGLWidget::ToggleDeepZoom()
+{
+    m_fractalTex.SetDeepZoom(! m_fractalTex.IsDeepZoom());
+    m_fractalTex.StopGenerate();
+}
+
 void CGLWidget::mouseMoveEvent(QMouseEvent *event)
 {
     int xpos = event->pos().rx();
@@ -323,6 +561,32 @@ void CGLWidget::mouseMoveEvent(QMouseEvent *event)
     if (event->buttons() & Qt::LeftButton) {
         m_fluidfx.SetMousePosition(xpos, ypos);
     }
+
+    // right drag pans the deep zoom view
+    if ((event->buttons() & Qt::RightButton) && m_fractalTex.IsDeepZoom()) {
+        QPoint delta = event->pos() - m_lastMousePos;
+        m_fractalTex.Pan(delta.x(), delta.y(), width(), height());
+    }
+    m_lastMousePos = event->pos();
+}
+
+void CGLWidget::mousePressEvent(QMouseEvent *event)
+{
+    m_lastMousePos = event->pos();
+}
+
+void CGLWidget::wheelEvent(QWheelEvent *event)
+{
+    if (! m_fractalTex.IsDeepZoom())
+    {
+        event->ignore();
+        return;
+    }
+
+    // one wheel notch (120) zooms by 1.5x around the cursor
+    double factor = std::pow(1.5, event->angleDelta().y() / 120.0);
+    m_fractalTex.ZoomAt(event->pos().x(), event->pos().y(),
+                        width(), height(), factor);
 }
 
 void CGLWidget::CreateTextureRenderTarget(int width, int height)
@@ -12,6 +12,8 @@
 
 class QOpenGLBuffer;
 class QOpenGLShaderProgram;
+struct SDeadlineStats;
+struct SCancelStats;
 
 class CGLWidget: public QGLWidget, protected QOpenGLFunctions
 {
@@ -20,7 +22,7 @@ class CGLWidget: public QGLWidget, protected QOpenGLFunctions
 public:
     enum BUFFER_MODE
     {
-        BF_SINGLE = 1, BF_TRIPLE, BF_DOUBLE
+        BF_SINGLE = 1, BF_TRIPLE, BF_DOUBLE, BF_RING
     };
 
     class PauseWorkers
@@ -47,6 +49,24 @@ public:
     ~CGLWidget();
 
     void ChangeBufferMode(BUFFER_MODE mode);
+    BUFFER_MODE GetBufferMode() const;
+    void ChangeHandoffPolicy(HANDOFF_POLICY policy);
+    const SUpdateStats& GetVideoUpdateStats() const;
+    const SUpdateStats& GetFractalUpdateStats() const;
+    FRAME_LAYOUT GetVideoFrameLayout() const;
+    void GetVideoFrameSize(int& width, int& height) const;
+    SConvertStats GetVideoConvertStats() const;
+    SPipelineStats GetVideoPipelineStats() const;
+    const SHandoffStats& GetFractalHandoffStats() const;
+    const SResizeStats& GetVideoResizeStats() const;
+    const SResizeStats& GetFractalResizeStats() const;
+    const SDeadlineStats& GetVideoDeadlineStats() const;
+    const SDeadlineStats& GetFractalDeadlineStats() const;
+    const SCancelStats& GetVideoCancelStats() const;
+    const SCancelStats& GetFractalCancelStats() const;
+    SFrameMemory GetVideoFrameMemory() const;
+    SFrameMemory GetFractalFrameMemory() const;
+    const CFractal& GetFractal() const;
     static QOpenGLFunctions* m_glProvider;
 
 public slots:
@@ -58,6 +78,25 @@ public slots:
     void NewVideo(const char* filename);
     void ChangeFluidMaxWidth(int value);
     void ChangeFluidMaxHeight(int value);
+    // Frames a worker may run ahead in BF_RING mode
+    void ChangeRingBufferDepth(int depth);
+    void BenchmarkFractal();
+    // Decode rates of the clips next to the current movie per thread count
+    void BenchmarkDecode();
+    /**
+     * Pauses and resumes each worker a number of times while it produces
+     * and prints the longest time it took to let go of its frame. Returns
+     * false if one of them took longer than kMaxCancelLatencyUs, or if no
+     * pause of a worker found a frame in progress to measure.
+     */
+    bool CheckCancelLatency();
+    // YUV planes converted by the shader or BGRA converted by the executor
+    void ToggleVideoYuv();
+    // Video frames at the size of the movie or of the window
+    void ToggleVideoNativeSize();
+    void ToggleDeepZoom();
+    void ToggleSubdivision();
+    void ToggleSymmetry();
 
 protected:
     void initializeGL() override;
@@ -66,6 +105,8 @@ protected:
 
 private:
     void mouseMoveEvent(QMouseEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
 
     void CreateTextureRenderTarget(int width, int height);
     void DestroyTextureRenderTarget();
@@ -82,10 +123,11 @@ private:
     CPageCurlFX m_pagecurlfx;
 
     CEffect* m_effects[FX_TOTAL];
-    std::vector<CWorker*> m_threads;
+    std::vector<CWorker*> m_workers;
     std::vector<CTextureObject*> m_threadTextures;
 
     BUFFER_MODE m_bufferMode;
+    int m_ringDepth;
     bool m_threadMode;
 
     // For render to texture, shared in all Effects
@@ -94,6 +136,9 @@ private:
     GLuint m_renderBufferId;
 
     int m_timeStamp;
+    QPoint m_lastMousePos;
+    // of the render thread, see CThreadPlacement
+    int m_placementId;
 };
 
 #endif // GLWIDGET_HPP
@@ -1,10 +1,21 @@
 #include "Stdafx.hpp"
 #include "MainWindow.hpp"
+#include "Executor.hpp"
+#include "FFmpegPlayer.hpp"
+#include "FramePool.hpp"
+#include "ThreadPlacement.hpp"
+#include "Worker.hpp"
 
 #include <QProgressBar>
 #include <QTime>
 #include <QTimer>
 
+namespace
+{
+    // how long the result of a check stays in the status bar
+    const int kCheckMessageMs = 5000;
+}
+
 CMainWindow::CMainWindow(QWidget* parent): QMainWindow(parent), m_timer(nullptr), m_fps(nullptr)
 {
     m_ui.setupUi(this);
@@ -22,6 +33,9 @@ CMainWindow::CMainWindow(QWidget* parent): QMainWindow(parent), m_timer(nullptr)
     connect(m_ui.noThreading, SIGNAL(toggled(bool)), this, SLOT(UseSingleBuffer(bool)));
     connect(m_ui.tripleBuffer, SIGNAL(toggled(bool)), this, SLOT(UseTripleBuffer(bool)));
     connect(m_ui.doubleBuffer, SIGNAL(toggled(bool)), this, SLOT(UseDoubleBuffer(bool)));
+    connect(m_ui.ringBuffer, SIGNAL(toggled(bool)), this, SLOT(UseRingBuffer(bool)));
+    connect(m_ui.ringDepth, SIGNAL(valueChanged(int)), m_ui.glwidget, SLOT(ChangeRingBufferDepth(int)));
+    connect(m_ui.latestFrameWins, SIGNAL(toggled(bool)), this, SLOT(UseLatestFrameWins(bool)));
 
     // Effect enable/disable signal
     connect(m_ui.fractalEnabled, SIGNAL(toggled(bool)), this, SLOT(EnableFractalFX(bool)));
@@ -64,6 +78,151 @@ void CMainWindow::TimerUpdate()
         float fps = (float)(currentTime - prevTime) / (float)numFrame;
         fps = 1000.f / fps;
         QString msg = "fps = " + QString::number(fps);
+
+        // bytes per video frame sent to the GPU, YUV planes or BGRA
+        static unsigned long long prevVideoBytes = 0;
+        const SUpdateStats& videoStats = m_ui.glwidget->GetVideoUpdateStats();
+        const unsigned long long videoBytes = videoStats.uploadedBytes;
+        int videoWidth, videoHeight;
+        m_ui.glwidget->GetVideoFrameSize(videoWidth, videoHeight);
+        msg += "  video " + QString(m_ui.glwidget->GetVideoFrameLayout() == LAYOUT_YUV420 ? "yuv" : "bgra") +
+               " " + QString::number(videoWidth) + "x" + QString::number(videoHeight) +
+               " upload " + QString::number((videoBytes - prevVideoBytes) * 1000.0 /
+                                            (currentTime - prevTime) / (1024 * 1024), 'f', 1) +
+               " MB/s";
+        prevVideoBytes = videoBytes;
+
+        // frames converted to the output layout in bands in parallel
+        static SConvertStats prevConvert = {};
+        const SConvertStats convert = m_ui.glwidget->GetVideoConvertStats();
+        if (convert.frames > prevConvert.frames)
+        {
+            msg += " convert avg " + QString::number((convert.totalUs - prevConvert.totalUs) /
+                                                     (convert.frames - prevConvert.frames)) +
+                   " us (last " + QString::number(convert.lastUs) + ") in " +
+                   QString::number(convert.slices) + " bands";
+        }
+        prevConvert = convert;
+
+        // queue fill between the demux, decode and convert stages and the
+        // ms each stage waited since the last update
+        static SPipelineStats prevPipeline = {};
+        const SPipelineStats pipeline = m_ui.glwidget->GetVideoPipelineStats();
+        msg += "  pipeline packets " + QString::number(pipeline.packets) + "/" +
+               QString::number(pipeline.packetCapacity) + " (avg " +
+               QString::number(pipeline.meanPackets, 'f', 1) + ") frames " +
+               QString::number(pipeline.frames) + "/" + QString::number(pipeline.frameCapacity) +
+               " (avg " + QString::number(pipeline.meanFrames, 'f', 1) + ") waits: demux full " +
+               QString::number(pipeline.demuxBlockedMs - prevPipeline.demuxBlockedMs) +
+               " decode full " + QString::number(pipeline.decodeBlockedMs - prevPipeline.decodeBlockedMs) +
+               " decode empty " + QString::number(pipeline.decodeStarvedMs - prevPipeline.decodeStarvedMs) +
+               " convert empty " + QString::number(pipeline.convertStarvedMs - prevPipeline.convertStarvedMs) +
+               " ms";
+        prevPipeline = pipeline;
+
+        // fractal frames and uploads avoided because nothing changed
+        const SUpdateStats& stats = m_ui.glwidget->GetFractalUpdateStats();
+        msg += "  fractal: " + QString::number(stats.producedFrames) + " computed, " +
+               QString::number(stats.skippedFrames) + " skipped, " +
+               QString::number(stats.skippedUploads) + " uploads skipped (" +
+               QString::number(stats.skippedUploadBytes / (1024 * 1024)) + " MB)";
+
+        const CFractal& fractal = m_ui.glwidget->GetFractal();
+        msg += "  depth " + QString::number(GetFractalDepthIteration(fractal.GetLastFrameDepth())) +
+               ", periodic orbits saved " +
+               QString::number(fractal.GetLastFrameSkippedIterations() / 1000000.0, 'f', 1) +
+               "M iterations";
+        if (fractal.IsSubdivision())
+        {
+            msg += ", subdivision filled " + QString::number(fractal.GetLastFrameFilledPixels()) +
+                   " pixels";
+        }
+        if (fractal.IsSymmetric())
+        {
+            msg += ", mirrored " + QString::number(fractal.GetLastFrameMirroredPixels()) +
+                   " pixels";
+        }
+        if (fractal.IsDeepZoom())
+        {
+            msg += "  deep zoom x" + QString::number(fractal.GetZoom(), 'g', 3) +
+                   ", " + QString::number(fractal.GetRebaseCount()) + " rebased pixels";
+        }
+        // worker to display latency of the fractal frames
+        const SHandoffStats& handoff = m_ui.glwidget->GetFractalHandoffStats();
+        if (m_ui.glwidget->GetBufferMode() != CGLWidget::BF_SINGLE && handoff.displayedFrames)
+        {
+            msg += "  handoff latency avg " +
+                   QString::number(handoff.latencyNsTotal / handoff.displayedFrames / 1000000.0, 'f', 1) +
+                   " ms, max " + QString::number(handoff.latencyNsMax / 1000000.0, 'f', 1) +
+                   " ms, " + QString::number(handoff.droppedFrames) + " dropped";
+        }
+        // resize to first frame of the new size on screen
+        const SResizeStats& videoResize = m_ui.glwidget->GetVideoResizeStats();
+        const SResizeStats& fractalResize = m_ui.glwidget->GetFractalResizeStats();
+        if (videoResize.completed || fractalResize.completed)
+        {
+            msg += "  resize latency video " + QString::number(videoResize.lastLatencyMs) +
+                   " ms (max " + QString::number(videoResize.maxLatencyMs) + "), fractal " +
+                   QString::number(fractalResize.lastLatencyMs) + " ms (max " +
+                   QString::number(fractalResize.maxLatencyMs) + "), " +
+                   QString::number(fractalResize.coalesced) + " coalesced";
+        }
+        // frame storage reused across resizes and buffer mode switches
+        const SFramePoolStats pool = CFramePool::GetInstance().GetStats();
+        msg += "  frame pool: " + QString::number(pool.hits) + " hits, " +
+               QString::number(pool.misses) + " misses, " +
+               QString::number(pool.bytesResident / (1024 * 1024)) + " MB resident";
+        // one set of frames per texture, whichever side has it
+        const SFrameMemory videoMemory = m_ui.glwidget->GetVideoFrameMemory();
+        const SFrameMemory fractalMemory = m_ui.glwidget->GetFractalFrameMemory();
+        msg += "  frames: video " + QString::number(videoMemory.bytes / (1024 * 1024)) +
+               " MB in " + QString::number(videoMemory.slabs) + ", fractal " +
+               QString::number(fractalMemory.bytes / (1024 * 1024)) + " MB in " +
+               QString::number(fractalMemory.slabs);
+        // frame and tile jobs of all producers on the shared threads
+        const SExecutorStats executor = CExecutor::GetInstance().GetStats();
+        msg += "  executor: " + QString::number(executor.threads) + " threads, " +
+               QString::number(executor.executed) + " jobs, " +
+               QString::number(executor.stolen) + " stolen";
+        // frames which would have missed their deadline
+        const SDeadlineStats& videoDeadline = m_ui.glwidget->GetVideoDeadlineStats();
+        const SDeadlineStats& fractalDeadline = m_ui.glwidget->GetFractalDeadlineStats();
+        msg += "  late frames: video " + QString::number(videoDeadline.skippedFrames) +
+               " skipped, fractal " + QString::number(fractalDeadline.reducedFrames) +
+               " reduced";
+        // time from cancelling a frame to the worker letting go of it
+        const SCancelStats& videoCancel = m_ui.glwidget->GetVideoCancelStats();
+        const SCancelStats& fractalCancel = m_ui.glwidget->GetFractalCancelStats();
+        if (videoCancel.requests || fractalCancel.requests)
+        {
+            msg += "  pause latency video " + QString::number(videoCancel.lastLatencyUs) +
+                   " us (max " + QString::number(videoCancel.maxLatencyUs) + "), fractal " +
+                   QString::number(fractalCancel.lastLatencyUs) + " us (max " +
+                   QString::number(fractalCancel.maxLatencyUs) + "), " +
+                   QString::number(videoCancel.overBudget + fractalCancel.overBudget) +
+                   " over " + QString::number(kMaxCancelLatencyUs / 1000) + " ms";
+        }
+        // where the threads ran, T prints it per thread
+        qint64 renderMs = 0, executorMs = 0;
+        unsigned long long renderMigrations = 0, executorMigrations = 0;
+        const std::vector<SThreadUsage> usage = CThreadPlacement::GetInstance().GetUsage();
+        for (auto& thread : usage)
+        {
+            if (thread.role == ROLE_RENDER)
+            {
+                renderMs += thread.cpuTimeMs;
+                renderMigrations += thread.migrations;
+            }
+            else
+            {
+                executorMs += thread.cpuTimeMs;
+                executorMigrations += thread.migrations;
+            }
+        }
+        msg += "  CPU: render " + QString::number(renderMs) + " ms, " +
+               QString::number(renderMigrations) + " migrations, executor " +
+               QString::number(executorMs) + " ms, " +
+               QString::number(executorMigrations) + " migrations";
         m_fps->setText(msg);
         prevTime = currentTime;
         numFrame = 0;
@@ -88,6 +247,17 @@ void CMainWindow::UseDoubleBuffer(bool checked)
         m_ui.glwidget->ChangeBufferMode(CGLWidget::BF_DOUBLE);
 }
 
+void CMainWindow::UseRingBuffer(bool checked)
+{
+    if (checked)
+        m_ui.glwidget->ChangeBufferMode(CGLWidget::BF_RING);
+}
+
+void CMainWindow::UseLatestFrameWins(bool checked)
+{
+    m_ui.glwidget->ChangeHandoffPolicy(checked ? HANDOFF_LATEST : HANDOFF_FIFO);
+}
+
 void CMainWindow::UpdateTransparencyLabel(int value)
 {
     m_ui.transparency->setText(QString("%1%").arg(value));
@@ -131,5 +301,53 @@ void CMainWindow::keyPressEvent(QKeyEvent* event)
     {
         QApplication::quit();
     }
+    else if (event->key() == Qt::Key_B)
+    {
+        // print fractal kernel timings of each instruction set to console
+        m_ui.glwidget->BenchmarkFractal();
+    }
+    else if (event->key() == Qt::Key_Z)
+    {
+        // deep zoom: mouse wheel zooms, right drag pans
+        m_ui.glwidget->ToggleDeepZoom();
+    }
+    else if (event->key() == Qt::Key_S)
+    {
+        // Mariani-Silver subdivision instead of computing every pixel
+        m_ui.glwidget->ToggleSubdivision();
+    }
+    else if (event->key() == Qt::Key_M)
+    {
+        // compute one half of the symmetric Julia set, mirror the other
+        m_ui.glwidget->ToggleSymmetry();
+    }
+    else if (event->key() == Qt::Key_T)
+    {
+        // CPU time and migrations of every thread to console
+        CThreadPlacement::GetInstance().PrintUsage();
+    }
+    else if (event->key() == Qt::Key_D)
+    {
+        // decoded frames per second of the test clips per thread count
+        m_ui.glwidget->BenchmarkDecode();
+    }
+    else if (event->key() == Qt::Key_L)
+    {
+        // pause and resume the workers, check how long each cancel takes
+        if (! m_ui.glwidget->CheckCancelLatency())
+        {
+            m_ui.statusBar->showMessage("Cancel latency over budget, see the console", kCheckMessageMs);
+        }
+    }
+    else if (event->key() == Qt::Key_Y)
+    {
+        // video colour conversion in the shader or on the executor
+        m_ui.glwidget->ToggleVideoYuv();
+    }
+    else if (event->key() == Qt::Key_N)
+    {
+        // video frames at the movie size, scaled by the GPU, or the window size
+        m_ui.glwidget->ToggleVideoNativeSize();
+    }
 }
 
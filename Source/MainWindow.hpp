@@ -22,6 +22,8 @@ private slots:
     void UseTripleBuffer(bool checked);
     void UseDoubleBuffer(bool checked);
     void UseSingleBuffer(bool checked);
+    void UseRingBuffer(bool checked);
+    void UseLatestFrameWins(bool checked);
     void UpdateTransparencyLabel(int value);
     void EnableFractalFX(bool enabled);
     void EnableFluidFX(bool enabled);
@@ -0,0 +1,68 @@
+#ifndef SPSCQUEUE_HPP
+#define SPSCQUEUE_HPP
+
+#include <atomic>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Bounded lock-free queue between one producer and one consumer thread. A
+// full queue is the backpressure: the producer's TryPush() fails until the
+// consumer has taken an item. Neither side ever blocks inside the queue.
+// ----------------------------------------------------------------------------
+
+template <typename T>
+class CSpscQueue
+{
+public:
+    explicit CSpscQueue(int capacity): m_items(capacity > 0 ? capacity : 1), m_head(0), m_tail(0)
+    {
+    }
+
+    // Producer only, false if the queue is full
+    bool TryPush(const T& item)
+    {
+        const unsigned int head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == m_items.size())
+            return false;
+
+        m_items[head % m_items.size()] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only, false if the queue is empty
+    bool TryPop(T& item)
+    {
+        const unsigned int tail = m_tail.load(std::memory_order_relaxed);
+        if (m_head.load(std::memory_order_acquire) == tail)
+            return false;
+
+        item = m_items[tail % m_items.size()];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Items queued right now, from any thread
+    int GetSize() const
+    {
+        return static_cast<int>(m_head.load(std::memory_order_acquire) -
+                                m_tail.load(std::memory_order_acquire));
+    }
+
+    int GetCapacity() const
+    {
+        return static_cast<int>(m_items.size());
+    }
+
+private:
+    CSpscQueue(const CSpscQueue&) = delete;
+    CSpscQueue& operator=(const CSpscQueue&) = delete;
+
+    std::vector<T> m_items;
+    // Items pushed and popped so far, wrapping around. m_head is only
+    // advanced by the producer, m_tail only by the consumer.
+    std::atomic<unsigned int> m_head;
+    std::atomic<unsigned int> m_tail;
+};
+
+#endif // SPSCQUEUE_HPP
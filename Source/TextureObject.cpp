@@ -1,43 +1,107 @@
 #include "Stdafx.hpp"
 #include "TextureObject.hpp"
 #include "Worker.hpp"
+#include "Executor.hpp"
 #include "FFmpegPlayer.hpp"
 #include "Fractal.hpp"
+#include "ThreadPlacement.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 
+namespace
+{
+    const int kVideoRowAlignment = 64;
+    // the requested size is packed into one word for the worker
+    const int kMaxTextureSize = 0xFFFF;
+    // for textures without a frame rate of their own, one display refresh
+    const int kDefaultFramePeriodMs = 16;
+    // frames made by the render thread itself are never cancelled
+    const CCancelToken kNeverCancelled;
+}
+
+
+SUpdateStats::SUpdateStats(): producedFrames(0), skippedFrames(0),
+                              skippedFrameBytes(0), uploadedFrames(0), uploadedBytes(0),
+                              skippedUploads(0), skippedUploadBytes(0)
+{
+}
 
-CTextureObject::CTextureObject(): m_worker(nullptr), m_textureId(0),
+SResizeStats::SResizeStats(): requests(0), coalesced(0), completed(0),
+                              lastLatencyMs(0), maxLatencyMs(0)
+{
+}
+
+CTextureObject::CTextureObject(): m_worker(nullptr), m_workerHasFrames(false),
+                                  m_textureWidth(0), m_textureHeight(0),
+                                  m_textureLayout(LAYOUT_PACKED),
                                   m_bufferFmt(0), m_internalFmt(0),
-                                  m_enableCount(0),
+                                  m_enableCount(0), m_uploadedVersion(0),
+                                  m_requestedSize(0), m_resizePending(false),
                                   m_time(0), m_msPerFrame(0)
 {
+    std::fill(m_textureIds, m_textureIds + kMaxFramePlanes, 0);
 }
 
 CTextureObject::~CTextureObject()
 {
-    GL().glDeleteTextures(1, &m_textureId);
+    GL().glDeleteTextures(kMaxFramePlanes, m_textureIds);
 }
 
 bool CTextureObject::Resize(int width, int height)
 {
-    if (m_buffer.GetWidth() == width && m_buffer.GetHeight() == height)
+    return ResizeFrames(width, height, false);
+}
+
+bool CTextureObject::ResizeFrames(int width, int height, bool force)
+{
+    AdjustFrameSize(width, height);
+
+    // keeps the worker from going back to an older requested size
+    width = std::min(width, kMaxTextureSize);
+    height = std::min(height, kMaxTextureSize);
+    m_requestedSize = static_cast<unsigned int>(width << 16 | height);
+
+    // the side without the frames takes the size along when it gets them
+    CBuffer* buf = GetFrameBuffer();
+    if (! force && buf->GetWidth() == width && buf->GetHeight() == height)
     {
         return false;
     }
 
-    if (m_worker)
+    buf->SetTextureSize(width, height);
+    buf->InitIntermediateBufferWithZero();
+
+    return true;
+}
+
+void CTextureObject::RequestResize(int width, int height)
+{
+    AdjustFrameSize(width, height);
+
+    width = std::max(1, std::min(width, kMaxTextureSize));
+    height = std::max(1, std::min(height, kMaxTextureSize));
+
+    const unsigned int size = static_cast<unsigned int>(width << 16 | height);
+    if (m_requestedSize.exchange(size) == size)
     {
-        CBuffer* buf = m_worker->GetInternalBuffer();
-        buf->SetTextureSize(width, height);
-        buf->InitIntermediateBufferWithZero();
+        return;
     }
-    m_buffer.SetTextureSize(width, height);
-    m_buffer.InitIntermediateBufferWithZero();
-    CreateTexture();
 
-    return true;
+    m_resizeStats.requests++;
+    if (m_resizePending)
+        m_resizeStats.coalesced++;
+
+    m_resizePending = true;
+    m_resizeTimer.start();
+}
+
+void CTextureObject::GetRequestedSize(int& width, int& height) const
+{
+    const unsigned int size = m_requestedSize;
+    width = static_cast<int>(size >> 16);
+    height = static_cast<int>(size & kMaxTextureSize);
 }
 
 void CTextureObject::StopUpdate()
@@ -67,26 +131,80 @@ void CTextureObject::UpdateByMySelf(int elapsedMs, bool forceUpdate)
     if (forceUpdate)
         m_time = 0.f;
 
-    DoUpdate(&m_buffer);
+    int width, height;
+    GetRequestedSize(width, height);
+    if (width > 0 && (width != m_buffer.GetWidth() || height != m_buffer.GetHeight()))
+    {
+        m_buffer.SetTextureSize(width, height);
+        m_buffer.InitIntermediateBufferWithZero();
+    }
+
+    // nothing to show before the first resize
+    if (m_buffer.GetWidth() <= 0)
+    {
+        return;
+    }
+
+    // shown right after it is produced
+    ProduceFrame(&m_buffer, CExecutor::GetInstance().GetTimeMs(), kNeverCancelled);
     UpdateTexture(&m_buffer);
 }
 
-void CTextureObject::CopyMyDataToWorker()
+bool CTextureObject::ProduceFrame(CBuffer* buffer, qint64 displayMs,
+                                  const CCancelToken& cancel)
+{
+    if (DoUpdate(buffer, displayMs, cancel))
+    {
+        m_stats.producedFrames++;
+        return true;
+    }
+
+    // the worker drops whatever is in the buffer
+    if (cancel.IsCancelled())
+    {
+        return false;
+    }
+
+    m_stats.skippedFrames++;
+    m_stats.skippedFrameBytes += buffer->GetSize();
+    return false;
+}
+
+void CTextureObject::MoveMyDataToWorker()
 {
     assert(m_worker && "Internal Error! This texture object should bind a worker.");
 
-    const CBuffer* src = &m_buffer;
-    CBuffer* dest = m_worker->GetInternalBuffer();
-    dest->InitIntermediateBuffer(src->GetIntermediateBuffer(), src->GetSize());
+    // the idle side may have missed some resizes, it takes the size along
+    m_worker->GetInternalBuffer()->MoveFramesFrom(m_buffer);
+    m_workerHasFrames = true;
 }
 
-void CTextureObject::CopyWorkerDataToMe()
+void CTextureObject::MoveWorkerDataToMe()
 {
     assert(m_worker && "Internal Error! This texture object should bind a worker.");
 
-    const CBuffer* src = m_worker->GetInternalBuffer();
-    CBuffer* dest = &m_buffer;
-    dest->InitIntermediateBuffer(src->GetIntermediateBuffer(), src->GetSize());
+    m_buffer.MoveFramesFrom(*m_worker->GetInternalBuffer());
+    m_workerHasFrames = false;
+}
+
+CBuffer* CTextureObject::GetFrameBuffer()
+{
+    if (m_worker && m_workerHasFrames)
+    {
+        return m_worker->GetInternalBuffer();
+    }
+    return &m_buffer;
+}
+
+SFrameMemory CTextureObject::GetFrameMemory() const
+{
+    SFrameMemory memory;
+    m_buffer.AddStorage(memory);
+    if (m_worker)
+    {
+        m_worker->AddStorage(memory);
+    }
+    return memory;
 }
 
 void CTextureObject::Enable()
@@ -104,6 +222,8 @@ void CTextureObject::SetTextureFormat(GLenum bufferFmt, GLint internalFmt)
 {
     m_bufferFmt = bufferFmt;
     m_internalFmt = internalFmt;
+    // the texture is created again in the new format with the next upload
+    m_textureWidth = 0;
     m_buffer.SetPixelSize(GetGLPixelSize(bufferFmt));
 
     if (m_worker)
@@ -112,6 +232,26 @@ void CTextureObject::SetTextureFormat(GLenum bufferFmt, GLint internalFmt)
     }
 }
 
+void CTextureObject::SetRowAlignment(int alignment)
+{
+    m_buffer.SetRowAlignment(alignment);
+
+    if (m_worker)
+    {
+        m_worker->GetInternalBuffer()->SetRowAlignment(alignment);
+    }
+}
+
+void CTextureObject::SetFrameLayout(FRAME_LAYOUT layout)
+{
+    m_buffer.SetLayout(layout);
+
+    if (m_worker)
+    {
+        m_worker->GetInternalBuffer()->SetLayout(layout);
+    }
+}
+
 CBuffer* CTextureObject::GetBuffer()
 {
     return &m_buffer;
@@ -122,9 +262,52 @@ CWorker* CTextureObject::GetWorker()
     return m_worker;
 }
 
-GLuint CTextureObject::GetTextureID() const
+const CWorker* CTextureObject::GetWorker() const
+{
+    return m_worker;
+}
+
+GLuint CTextureObject::GetTextureID(int plane) const
+{
+    return m_textureIds[plane];
+}
+
+FRAME_LAYOUT CTextureObject::GetTextureLayout() const
+{
+    return m_textureLayout;
+}
+
+const SUpdateStats& CTextureObject::GetUpdateStats() const
+{
+    return m_stats;
+}
+
+const SResizeStats& CTextureObject::GetResizeStats() const
 {
-    return m_textureId;
+    return m_resizeStats;
+}
+
+int CTextureObject::GetFramePeriodMs() const
+{
+    if (m_msPerFrame > 0.f)
+    {
+        return std::max(1, static_cast<int>(m_msPerFrame + 0.5f));
+    }
+    return kDefaultFramePeriodMs;
+}
+
+void CTextureObject::AdjustFrameSize(int& /*width*/, int& /*height*/) const
+{
+}
+
+bool CTextureObject::SkipFrame(const CCancelToken& /*cancel*/)
+{
+    return false;
+}
+
+bool CTextureObject::ReduceFrameQuality()
+{
+    return false;
 }
 
 bool CTextureObject::Timeout(int elapsedMs)
@@ -146,85 +329,301 @@ bool CTextureObject::Timeout(int elapsedMs)
     return false;
 }
 
-void CTextureObject::CreateTexture()
+void CTextureObject::CreateTexture(const CBuffer* buf)
 {
-    if (m_textureId != 0)
+    const int planes = buf->GetPlaneCount();
+    for (int plane = 0; plane < kMaxFramePlanes; ++plane)
     {
-        glDeleteTextures(1, &m_textureId);
+        GLuint& id = m_textureIds[plane];
+        if (plane >= planes)
+        {
+            GL().glDeleteTextures(1, &id);
+            id = 0;
+            continue;
+        }
+
+        // the id stays, effects may hold on to it
+        if (id == 0)
+        {
+            GL().glGenTextures(1, &id);
+            GL().glBindTexture(GL_TEXTURE_2D, id);
+            GL().glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            GL().glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            GL().glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        }
+
+        GL().glBindTexture(GL_TEXTURE_2D, id);
+        GL().glTexImage2D(GL_TEXTURE_2D, 0, m_internalFmt, buf->GetPlaneWidth(plane),
+                          buf->GetPlaneHeight(plane), 0, m_bufferFmt, GL_UNSIGNED_BYTE, nullptr);
     }
-
-    GL().glGenTextures(1, &m_textureId);
-    GL().glBindTexture(GL_TEXTURE_2D, m_textureId);
-    GL().glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    GL().glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    GL().glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-
-    GL().glTexImage2D(GL_TEXTURE_2D, 0, m_internalFmt,
-                      m_buffer.GetWidth(), m_buffer.GetHeight(),
-                      0, m_bufferFmt, GL_UNSIGNED_BYTE, nullptr);
+    m_textureWidth = buf->GetWidth();
+    m_textureHeight = buf->GetHeight();
+    m_textureLayout = buf->GetLayout();
+    m_uploadedVersion = 0;
 }
 
 void CTextureObject::UpdateTexture(const CBuffer* buf)
 {
-    void* data = buf->GetStableBuffer();
+    // Frames keep the size they were produced at, the texture follows them.
+    // Until a frame of the requested size arrives the old one is stretched.
+    if (buf->GetWidth() != m_textureWidth || buf->GetHeight() != m_textureHeight ||
+        buf->GetLayout() != m_textureLayout)
+    {
+        CreateTexture(buf);
+    }
+
+    if (m_resizePending)
+    {
+        int width, height;
+        GetRequestedSize(width, height);
+        if (buf->GetWidth() == width && buf->GetHeight() == height)
+        {
+            const qint64 latencyMs = m_resizeTimer.elapsed();
+            m_resizeStats.completed++;
+            m_resizeStats.lastLatencyMs = latencyMs;
+            m_resizeStats.maxLatencyMs = std::max(m_resizeStats.maxLatencyMs, latencyMs);
+            m_resizePending = false;
+        }
+    }
+
+    const unsigned long long version = buf->GetStableVersion();
+    if (version != 0 && version == m_uploadedVersion)
+    {
+        m_stats.skippedUploads++;
+        m_stats.skippedUploadBytes += buf->GetSize();
+        return;
+    }
+
+    m_uploadedVersion = version;
+    m_stats.uploadedFrames++;
+    m_stats.uploadedBytes += buf->GetSize();
+
+    const unsigned char* frame = buf->GetStableBuffer();
 
-    glBindTexture(GL_TEXTURE_2D, m_textureId);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, buf->GetWidth(), buf->GetHeight(),
-                    m_bufferFmt, GL_UNSIGNED_BYTE, data);
+    const int planes = buf->GetPlaneCount();
+    for (int plane = 0; plane < planes; ++plane)
+    {
+        glBindTexture(GL_TEXTURE_2D, m_textureIds[plane]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, buf->GetPlaneStride(plane) / buf->GetPixelSize());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, buf->GetPlaneWidth(plane),
+                        buf->GetPlaneHeight(plane), m_bufferFmt, GL_UNSIGNED_BYTE,
+                        frame + buf->GetPlaneOffset(plane));
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+CVideoTexture::CVideoTexture(): m_layout(LAYOUT_YUV420), m_nativeSize(true)
+{
 }
 
-void CVideoTexture::DoUpdate(CBuffer* buffer)
+bool CVideoTexture::DoUpdate(CBuffer* buffer, qint64, const CCancelToken& cancel)
 {
     if (m_ffmpegPlayer == nullptr)
     {
-        memset(buffer->GetWorkingBuffer(), 0, buffer->GetSize());
-        return;
+        // a black frame of this size
+        const int inputs[] = { 0, buffer->GetWidth(), buffer->GetHeight() };
+        const unsigned long long version = CBuffer::MakeVersion(inputs, sizeof(inputs));
+        if (version == buffer->GetLatestVersion())
+        {
+            return false;
+        }
+
+        buffer->ClearFrame(buffer->GetWorkingBuffer());
+        buffer->SetWorkingVersion(version);
+        return true;
     }
 
+    // the scaler follows whatever buffer it is given
+    m_ffmpegPlayer->setOutputSize(buffer->GetWidth(), buffer->GetHeight(), buffer->GetLayout());
+
+    unsigned char* planes[kMaxFramePlanes];
+    int strides[kMaxFramePlanes];
+    buffer->GetPlanes(buffer->GetWorkingBuffer(), planes, strides);
+
     unsigned int pts;
     bool newframe = false;
 
+    // false at the end of the movie
     while (! newframe)
     {
-        newframe = m_ffmpegPlayer->decodeFrame(pts,
-                                               buffer->GetWorkingBuffer(),
-                                               buffer->GetRowSize());
+        // With the decode stage behind the worker asks again a little
+        // later, the executor thread doesn't wait for it
+        if (cancel.IsCancelled() || ! m_ffmpegPlayer->frameReady())
+        {
+            return false;
+        }
+
+        newframe = m_ffmpegPlayer->decodeFrame(pts, planes, strides, &cancel);
     }
+
+    // the conversion may have been cut short, the player keeps the frame
+    // and converts it again next time
+    if (cancel.IsCancelled())
+    {
+        return false;
+    }
+
+    // pts repeats when the video loops, every decoded frame is new content
+    buffer->SetWorkingVersion(CBuffer::NewUniqueVersion());
+    return true;
 }
 
-bool CVideoTexture::Resize(int width, int height)
+bool CVideoTexture::SkipFrame(const CCancelToken& cancel)
 {
-    if (! CTextureObject::Resize(width, height))
+    if (m_ffmpegPlayer == nullptr)
     {
         return false;
     }
 
-    if (m_ffmpegPlayer != nullptr)
+    // The decode stage needs every frame for the ones after it, only the
+    // conversion into the buffer is left out. Nothing is left out if it
+    // was cancelled first.
+    unsigned int pts;
+    while (! cancel.IsCancelled())
+    {
+        // nothing decoded yet to leave out
+        if (! m_ffmpegPlayer->frameReady())
+        {
+            return false;
+        }
+
+        if (m_ffmpegPlayer->decodeFrame(pts, nullptr, nullptr))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CVideoTexture::AdjustFrameSize(int& width, int& height) const
+{
+    // the size the decoder puts out, so sws_scale only copies the planes
+    if (m_nativeSize && m_ffmpegPlayer)
     {
-        m_ffmpegPlayer->setOutputSize(width, height);
+        m_ffmpegPlayer->getSourceSize(width, height);
+    }
+}
+
+bool CVideoTexture::Resize(int width, int height)
+{
+    return ResizeVideo(width, height, false);
+}
+
+void CVideoTexture::ResetFrames(int width, int height)
+{
+    ResizeVideo(width, height, true);
+}
+
+bool CVideoTexture::ResizeVideo(int width, int height, bool force)
+{
+    if (! ResizeFrames(width, height, force))
+    {
+        return false;
     }
 
     // decode one frame to initialize result buffer
-    UpdateByMySelf(0, true);
-    if (m_worker)
+    if (m_worker && m_workerHasFrames)
     {
-        m_worker->GetInternalBuffer()->InitIntermediateBuffer(
-            m_buffer.GetWorkingBuffer(), m_buffer.GetSize());
+        // straight into the worker's buffer, which hands it on
+        CBuffer* buffer = m_worker->GetInternalBuffer();
+        // nothing decoded yet, the zeroed frame stays until the worker has one
+        if (ProduceFrame(buffer, CExecutor::GetInstance().GetTimeMs(), kNeverCancelled))
+        {
+            buffer->InitIntermediateBuffer(buffer->GetWorkingBuffer(), buffer->GetSize());
+        }
+    }
+    else
+    {
+        UpdateByMySelf(0, true);
     }
     return true;
 }
 
 bool CVideoTexture::ChangeVideo(const std::string& fileName)
 {
+    // the decoder threads of the old movie give their cores back first
+    m_ffmpegPlayer.reset();
+    if (OpenVideo(fileName))
+    {
+        m_fileName = fileName;
+        return true;
+    }
+
+    if (! m_fileName.empty())
+    {
+        OpenVideo(m_fileName);
+    }
+    return false;
+}
+
+const std::string& CVideoTexture::GetFileName() const
+{
+    return m_fileName;
+}
+
+void CVideoTexture::ChangeFrameLayout(FRAME_LAYOUT layout)
+{
+    m_layout = layout;
+    if (layout == LAYOUT_YUV420)
+    {
+        SetTextureFormat(GL_RED, GL_R8);
+    }
+    else
+    {
+        SetTextureFormat(GL_BGRA, GL_RGBA);
+    }
+    SetFrameLayout(layout);
+}
+
+FRAME_LAYOUT CVideoTexture::GetFrameLayout() const
+{
+    return m_layout;
+}
+
+void CVideoTexture::SetNativeSize(bool native)
+{
+    m_nativeSize = native;
+}
+
+bool CVideoTexture::IsNativeSize() const
+{
+    return m_nativeSize;
+}
+
+SConvertStats CVideoTexture::GetConvertStats() const
+{
+    if (m_ffmpegPlayer == nullptr)
+    {
+        const SConvertStats none = {};
+        return none;
+    }
+    return m_ffmpegPlayer->getConvertStats();
+}
+
+SPipelineStats CVideoTexture::GetPipelineStats() const
+{
+    if (m_ffmpegPlayer == nullptr)
+    {
+        const SPipelineStats none = {};
+        return none;
+    }
+    return m_ffmpegPlayer->getPipelineStats();
+}
+
+bool CVideoTexture::OpenVideo(const std::string& fileName)
+{
+    const SDecodeThreading& threading = CThreadPlacement::GetInstance().GetDecodeThreading();
     try {
         std::unique_ptr<CFFmpegPlayer> player(
-            new CFFmpegPlayer(fileName));
+            new CFFmpegPlayer(fileName, threading.mode, threading.threads));
 
         m_ffmpegPlayer = std::move(player);
-        SetTextureFormat(GL_BGRA, GL_RGBA);
+        ChangeFrameLayout(m_layout);
+        // cache line aligned rows for the SIMD paths of sws_scale
+        SetRowAlignment(kVideoRowAlignment);
 
         // assume framerate is 24 fps
         m_msPerFrame = 1000.f / 24.f;
@@ -240,17 +639,73 @@ bool CVideoTexture::ChangeVideo(const std::string& fileName)
     return false;
 }
 
-CFractalTexture::CFractalTexture()
+CFractalTexture::CFractalTexture(): m_reduceQuality(false)
 {
 }
 
-void CFractalTexture::DoUpdate(CBuffer* buffer)
+bool CFractalTexture::DoUpdate(CBuffer* buffer, qint64 displayMs,
+                               const CCancelToken& cancel)
 {
-    GenerateFractal(buffer->GetWidth(), buffer->GetHeight(),
-                    buffer->GetWorkingBuffer());
+    AdvanceAnimation(displayMs);
+
+    const bool reduceQuality = m_reduceQuality;
+    m_reduceQuality = false;
+
+    // the fractal is computed into packed rows
+    assert(buffer->GetStride() == buffer->GetRowSize());
+
+    const unsigned long long version =
+        GetContentVersion(buffer->GetWidth(), buffer->GetHeight());
+    if (version == buffer->GetLatestVersion())
+    {
+        return false;
+    }
+
+    PassCallback publish;
+    if (m_worker && buffer == m_worker->GetInternalBuffer())
+    {
+        CWorker* worker = m_worker;
+        publish = [worker](int) { worker->PublishPartialResult(); };
+    }
+
+    // only the coarse pass, the frame is computed in full next time
+    if (reduceQuality)
+    {
+        StopGenerate();
+    }
+
+    const bool completed = GenerateFractal(buffer->GetWidth(), buffer->GetHeight(),
+                                           buffer->GetWorkingBuffer(), publish, &cancel);
+    if (cancel.IsCancelled())
+    {
+        return false;
+    }
+
+    // a stopped frame must be computed again next time
+    buffer->SetWorkingVersion(completed ? version : CBuffer::NewUniqueVersion());
+    return true;
 }
 
 void CFractalTexture::StopUpdate()
 {
     StopGenerate();
 }
+
+int CFractalTexture::GetFramePeriodMs() const
+{
+    // the iteration depth is adapted to make frames in this time
+    const int budgetMs = GetFrameBudget();
+    return budgetMs > 0 ? budgetMs : CTextureObject::GetFramePeriodMs();
+}
+
+bool CFractalTexture::ReduceFrameQuality()
+{
+    // a stopped frame which isn't progressive is incomplete
+    if (! IsProgressive())
+    {
+        return false;
+    }
+
+    m_reduceQuality = true;
+    return true;
+}
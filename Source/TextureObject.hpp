@@ -2,44 +2,140 @@
 #define TEXTUREOBJECT_HPP
 
 #include "Buffer.hpp"
+#include "CancelToken.hpp"
 #include <QOpenGLFunctions>
+#include <QElapsedTimer>
+#include <atomic>
+#include <memory>
 
 class CWorker;
 
+// Work avoided because the content version didn't change
+struct SUpdateStats
+{
+    SUpdateStats();
+
+    std::atomic<unsigned long long> producedFrames;
+    std::atomic<unsigned long long> skippedFrames;
+    std::atomic<unsigned long long> skippedFrameBytes;
+    std::atomic<unsigned long long> uploadedFrames;
+    std::atomic<unsigned long long> uploadedBytes;
+    std::atomic<unsigned long long> skippedUploads;
+    std::atomic<unsigned long long> skippedUploadBytes;
+};
+
+// Resize requests and how long until a frame of the new size was shown.
+// Only touched by the render thread.
+struct SResizeStats
+{
+    SResizeStats();
+
+    unsigned long long requests;
+    // requests replaced by a newer one before their frame was shown
+    unsigned long long coalesced;
+    unsigned long long completed;
+    qint64 lastLatencyMs;
+    qint64 maxLatencyMs;
+};
+
 class CTextureObject
 {
 public:
     CTextureObject();
     virtual ~CTextureObject();
+    // Resizes all buffers at once for a window of width x height, the
+    // worker must be paused
     virtual bool Resize(int width, int height);
+    /**
+     * Never blocks. Whoever produces the next frame picks up the new size,
+     * until then the old frames are shown stretched. Only the latest of
+     * several requests in a row is followed. The size is the window size,
+     * the frames get the one AdjustFrameSize() makes of it.
+     */
+    void RequestResize(int width, int height);
+    // Latest requested size, 0 x 0 before the first request
+    void GetRequestedSize(int& width, int& height) const;
     virtual void StopUpdate();
 
     void UpdateByWorker(int elapsedMs);
     void UpdateByMySelf(int elapsedMs, bool forceUpdate = false);
-    void CopyMyDataToWorker();
-    void CopyWorkerDataToMe();
+    // The frames live either in the texture object or in its worker, never
+    // in both. These hand them over when the buffer mode changes.
+    void MoveMyDataToWorker();
+    void MoveWorkerDataToMe();
 
     void Enable();
     void Disable();
 
     void SetTextureFormat(GLenum bufferFmt, GLint internalFmt);
+    // Row padding of the frame buffers, see CBuffer::SetRowAlignment()
+    void SetRowAlignment(int alignment);
+    // Every plane of the frames gets a texture of its own in the texture
+    // format, see CBuffer::SetLayout()
+    void SetFrameLayout(FRAME_LAYOUT layout);
     CBuffer* GetBuffer();
     CWorker* GetWorker();
-    GLuint GetTextureID() const;
+    const CWorker* GetWorker() const;
+    // 0 for planes the frames don't have
+    GLuint GetTextureID(int plane = 0) const;
+    // Of the frame in the textures
+    FRAME_LAYOUT GetTextureLayout() const;
+    const SUpdateStats& GetUpdateStats() const;
+    const SResizeStats& GetResizeStats() const;
+    // Frame storage of the texture object and its worker, for the render
+    // thread
+    SFrameMemory GetFrameMemory() const;
+    // Time between two frames on screen, the worker gives every frame a
+    // deadline one period after the previous one
+    virtual int GetFramePeriodMs() const;
 
 protected:
+    // Frames have the size of the window unless this says otherwise
+    virtual void AdjustFrameSize(int& width, int& height) const;
+    // Like Resize(), with @p force the frames are made again at the same size
+    bool ResizeFrames(int width, int height, bool force);
     bool Timeout(int elapsedMs);
-    virtual void DoUpdate(CBuffer* buffer) = 0;
-    void CreateTexture();
+    // Writes the frame shown at displayMs, in CExecutor::GetTimeMs() time,
+    // into buffer->GetWorkingBuffer() and tags it with SetWorkingVersion().
+    // Returns false if the frame would be identical to the latest one and
+    // nothing was written, or if it was cancelled.
+    virtual bool DoUpdate(CBuffer* buffer, qint64 displayMs, const CCancelToken& cancel) = 0;
+    // Called by the worker instead of DoUpdate() when the next frame would
+    // miss its deadline and leaving it out catches up. Moves the content on
+    // by one frame without producing it, returns false if it can't.
+    virtual bool SkipFrame(const CCancelToken& cancel);
+    // Called by the worker before DoUpdate() when the frame is late anyway.
+    // Returns false if there is no cheaper version of the frame.
+    virtual bool ReduceFrameQuality();
+    bool ProduceFrame(CBuffer* buffer, qint64 displayMs, const CCancelToken& cancel);
+    // The buffer holding the frames right now, the worker's or m_buffer
+    CBuffer* GetFrameBuffer();
+    void CreateTexture(const CBuffer* buf);
     void UpdateTexture(const CBuffer* buf);
 
     CWorker* m_worker;
+    // without storage while the worker has the frames
     CSingleBuffer m_buffer;
-    GLuint m_textureId;
+    bool m_workerHasFrames;
+    GLuint m_textureIds[kMaxFramePlanes];
+    int m_textureWidth;
+    int m_textureHeight;
+    FRAME_LAYOUT m_textureLayout;
     GLenum m_bufferFmt;
     GLint m_internalFmt;
     quint8 m_enableCount;
 
+    // content version currently in the GL texture
+    unsigned long long m_uploadedVersion;
+    SUpdateStats m_stats;
+
+    // width << 16 | height, read by the worker before every frame
+    std::atomic<unsigned int> m_requestedSize;
+    // since the latest request which has no frame on screen yet
+    QElapsedTimer m_resizeTimer;
+    bool m_resizePending;
+    SResizeStats m_resizeStats;
+
     // framerate control:
     float m_time;
     float m_msPerFrame;  // ms per frame: update a frame every m_msPerFrame ms
@@ -52,16 +148,53 @@ protected:
 // ----------------------------------------------------------------------------
 
 class CFFmpegPlayer;
+struct SConvertStats;
+struct SPipelineStats;
 
 class CVideoTexture: public CTextureObject
 {
 public:
-    void DoUpdate(CBuffer* buffer) override;
+    CVideoTexture();
+    // Frames come in stream order, the worker skips late ones
+    bool DoUpdate(CBuffer* buffer, qint64 displayMs, const CCancelToken& cancel) override;
     bool Resize(int width, int height) override;
+    // New frames after the movie or the layout changed, the worker must be
+    // paused
+    void ResetFrames(int width, int height);
+    // Keeps the movie before if @p fileName can't be opened
     bool ChangeVideo(const std::string& fileName);
+    const std::string& GetFileName() const;
+    /**
+     * LAYOUT_YUV420 uploads the decoded planes and leaves the colour
+     * conversion to the shader, LAYOUT_PACKED converts to BGRA on the
+     * executor. The worker must be paused and the texture resized after.
+     */
+    void ChangeFrameLayout(FRAME_LAYOUT layout);
+    FRAME_LAYOUT GetFrameLayout() const;
+    /**
+     * Keeps the frames at the size of the movie and leaves the scaling to
+     * the texture filtering when they are drawn, so resizing the window
+     * doesn't touch the decoding. ResetFrames() must follow.
+     */
+    void SetNativeSize(bool native);
+    bool IsNativeSize() const;
+    // Conversion time of the decoded frames, all zero without a movie
+    SConvertStats GetConvertStats() const;
+    // Queues between the stages of the player, all zero without a movie
+    SPipelineStats GetPipelineStats() const;
+
+protected:
+    bool SkipFrame(const CCancelToken& cancel) override;
+    void AdjustFrameSize(int& width, int& height) const override;
 
 private:
+    bool OpenVideo(const std::string& fileName);
+    bool ResizeVideo(int width, int height, bool force);
+
     std::unique_ptr<CFFmpegPlayer> m_ffmpegPlayer;
+    std::string m_fileName;
+    FRAME_LAYOUT m_layout;
+    bool m_nativeSize;
 };
 
 #include "Fractal.hpp"
@@ -69,8 +202,17 @@ class CFractalTexture: public CTextureObject, public CFractal
 {
 public:
     CFractalTexture();
-    void DoUpdate(CBuffer* buffer) override;
+    // The animation is computed for displayMs
+    bool DoUpdate(CBuffer* buffer, qint64 displayMs, const CCancelToken& cancel) override;
     void StopUpdate() override;
+    int GetFramePeriodMs() const override;
+
+protected:
+    bool ReduceFrameQuality() override;
+
+private:
+    // the next frame stops after its first coarse pass
+    bool m_reduceQuality;
 };
 
 QOpenGLFunctions& GL();
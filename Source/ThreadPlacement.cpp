@@ -0,0 +1,604 @@
+#include "Stdafx.hpp"
+#include "ThreadPlacement.hpp"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QSettings>
+#include <QThread>
+#include <algorithm>
+#include <iostream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const char* const kSettingsFile = "ThreadedMoviePlayback.ini";
+    const char* const kSettingsGroup = "threads";
+    const int kMinNice = -20;
+    const int kMaxNice = 19;
+    // Reading the CPU time is a system call, reading the core is not
+    const unsigned int kCpuTimeSampleInterval = 16;
+
+    enum PLACEMENT_OPTION
+    {
+        OPTION_RENDER_CORES,
+        OPTION_RENDER_NICE,
+        OPTION_EXECUTOR_CORES,
+        OPTION_EXECUTOR_NICE,
+        OPTION_RESERVED_CORE,
+        OPTION_DECODE_THREADING,
+        OPTION_DECODE_THREADS,
+        OPTION_TOTAL
+    };
+
+    struct SOption
+    {
+        const char* name;
+        const char* settingsKey;
+        const char* description;
+    };
+
+    const SOption kOptions[OPTION_TOTAL] =
+    {
+        { "render-cores", "renderCores", "Cores of the render thread, e.g. 0,1." },
+        { "render-nice", "renderNice", "Nice value of the render thread." },
+        { "executor-cores", "executorCores", "Cores of the decode and fractal threads." },
+        { "executor-nice", "executorNice", "Nice value of the decode and fractal threads." },
+        { "reserve-render-core", "reservedRenderCore", "Core only the render thread runs on." },
+        { "decode-threading", "decodeThreading", "Decoder threads: single, frame, slice or both." },
+        { "decode-threads", "decodeThreads", "Decoder threads, 0 for as many as the frame size needs." }
+    };
+
+    // in the order of DECODE_THREADING
+    const char* const kDecodeThreadingNames[] = { "single", "frame", "slice", "both" };
+
+    bool SetCurrentThreadCores(const std::vector<int>& cores)
+    {
+#if defined(_WIN32)
+        DWORD_PTR mask = 0;
+        for (int core : cores)
+        {
+            // one processor group only
+            if (core < static_cast<int>(sizeof(mask) * 8))
+                mask |= static_cast<DWORD_PTR>(1) << core;
+        }
+        return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int core : cores)
+        {
+            CPU_SET(core, &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cores;
+        return false;
+#endif
+    }
+
+    bool SetCurrentThreadNice(int nice)
+    {
+#if defined(_WIN32)
+        int priority = THREAD_PRIORITY_NORMAL;
+        if (nice <= -15)
+            priority = THREAD_PRIORITY_HIGHEST;
+        else if (nice < 0)
+            priority = THREAD_PRIORITY_ABOVE_NORMAL;
+        else if (nice >= 15)
+            priority = THREAD_PRIORITY_LOWEST;
+        else if (nice > 0)
+            priority = THREAD_PRIORITY_BELOW_NORMAL;
+        return SetThreadPriority(GetCurrentThread(), priority) != 0;
+#elif defined(__linux__)
+        // The nice value is per thread on Linux. Going below the current
+        // value needs CAP_SYS_NICE.
+        const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+        return setpriority(PRIO_PROCESS, tid, nice) == 0;
+#else
+        (void)nice;
+        return false;
+#endif
+    }
+
+    bool GetCurrentThreadCores(std::vector<int>& cores)
+    {
+        cores.clear();
+#if defined(_WIN32)
+        // There is no getter, setting a mask returns the one before
+        DWORD_PTR process, system;
+        if (! GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+            return false;
+        const DWORD_PTR mask = SetThreadAffinityMask(GetCurrentThread(), process);
+        if (mask == 0)
+            return false;
+        SetThreadAffinityMask(GetCurrentThread(), mask);
+        for (int core = 0; core < static_cast<int>(sizeof(mask) * 8); ++core)
+        {
+            if (mask & static_cast<DWORD_PTR>(1) << core)
+                cores.push_back(core);
+        }
+        return true;
+#elif defined(__linux__)
+        cpu_set_t set;
+        if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            return false;
+        for (int core = 0; core < CPU_SETSIZE; ++core)
+        {
+            if (CPU_ISSET(core, &set))
+                cores.push_back(core);
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // The nice value on Linux, the priority level on Windows
+    bool GetCurrentThreadPriority(int& priority)
+    {
+#if defined(_WIN32)
+        priority = GetThreadPriority(GetCurrentThread());
+        return priority != THREAD_PRIORITY_ERROR_RETURN;
+#elif defined(__linux__)
+        const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+        errno = 0;
+        priority = getpriority(PRIO_PROCESS, tid);
+        return errno == 0;
+#else
+        (void)priority;
+        return false;
+#endif
+    }
+
+    bool SetCurrentThreadPriority(int priority)
+    {
+#if defined(_WIN32)
+        return SetThreadPriority(GetCurrentThread(), priority) != 0;
+#elif defined(__linux__)
+        return SetCurrentThreadNice(priority);
+#else
+        (void)priority;
+        return false;
+#endif
+    }
+
+    int GetCurrentCore()
+    {
+#if defined(_WIN32)
+        return static_cast<int>(GetCurrentProcessorNumber());
+#elif defined(__linux__)
+        return sched_getcpu();
+#else
+        return -1;
+#endif
+    }
+
+    qint64 GetCurrentThreadCpuTimeMs()
+    {
+#if defined(_WIN32)
+        FILETIME creation, exited, kernel, user;
+        if (! GetThreadTimes(GetCurrentThread(), &creation, &exited, &kernel, &user))
+        {
+            return 0;
+        }
+
+        // in 100 ns units
+        const qint64 kernelTime = static_cast<qint64>(kernel.dwHighDateTime) << 32 | kernel.dwLowDateTime;
+        const qint64 userTime = static_cast<qint64>(user.dwHighDateTime) << 32 | user.dwLowDateTime;
+        return (kernelTime + userTime) / 10000;
+#elif defined(__linux__)
+        timespec time;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0)
+        {
+            return 0;
+        }
+        return static_cast<qint64>(time.tv_sec) * 1000 + time.tv_nsec / 1000000;
+#else
+        return 0;
+#endif
+    }
+
+    const char* GetRoleName(THREAD_ROLE role)
+    {
+        return role == ROLE_RENDER ? "render" : "executor";
+    }
+}
+
+SThreadPlacement::SThreadPlacement(): nice(0)
+{
+}
+
+SDecodeThreading::SDecodeThreading(): mode(DECODE_FRAME_SLICE), threads(0)
+{
+}
+
+// -----------------------------------------------------------------------------
+// CThreadPlacement Functions
+// -----------------------------------------------------------------------------
+CThreadPlacement CThreadPlacement::s_instance;
+
+CThreadPlacement::CThreadPlacement(): m_configured(false), m_coreCount(0), m_reservedCores(0),
+                                      m_executorCores(0), m_threadCount(0)
+{
+}
+
+CThreadPlacement& CThreadPlacement::GetInstance()
+{
+    return s_instance;
+}
+
+void CThreadPlacement::Configure(const QStringList& arguments)
+{
+    m_coreCount = QThread::idealThreadCount();
+
+    QCommandLineParser parser;
+    std::vector<QCommandLineOption> options;
+    for (int i = 0; i < OPTION_TOTAL; ++i)
+    {
+        options.push_back(QCommandLineOption(kOptions[i].name, kOptions[i].description, "value"));
+        parser.addOption(options.back());
+    }
+
+    // The options Qt takes itself are unknown here. Whatever could be
+    // parsed is used anyway.
+    if (! parser.parse(arguments))
+    {
+        std::cout << "Thread placement: " << parser.errorText().toStdString() << std::endl;
+    }
+
+    // the command line wins over the settings file
+    QSettings settings(QCoreApplication::applicationDirPath() + "/" + kSettingsFile,
+                       QSettings::IniFormat);
+    settings.beginGroup(kSettingsGroup);
+    QString values[OPTION_TOTAL];
+    for (int i = 0; i < OPTION_TOTAL; ++i)
+    {
+        // a comma makes a list of the value
+        values[i] = settings.value(kOptions[i].settingsKey).toStringList().join(",");
+        if (parser.isSet(options[i]))
+            values[i] = parser.value(options[i]);
+    }
+
+    SThreadPlacement& render = m_placements[ROLE_RENDER];
+    SThreadPlacement& executor = m_placements[ROLE_EXECUTOR];
+    render.cores = ParseCores(values[OPTION_RENDER_CORES], kOptions[OPTION_RENDER_CORES].name);
+    render.nice = ParseNice(values[OPTION_RENDER_NICE], kOptions[OPTION_RENDER_NICE].name);
+    executor.cores = ParseCores(values[OPTION_EXECUTOR_CORES], kOptions[OPTION_EXECUTOR_CORES].name);
+    executor.nice = ParseNice(values[OPTION_EXECUTOR_NICE], kOptions[OPTION_EXECUTOR_NICE].name);
+
+    const std::vector<int> reserved =
+        ParseCores(values[OPTION_RESERVED_CORE], kOptions[OPTION_RESERVED_CORE].name);
+    if (reserved.size() > 1 || (! reserved.empty() && m_coreCount < 2))
+    {
+        std::cout << "Thread placement: one core of at least two can be reserved" << std::endl;
+    }
+    else if (! reserved.empty())
+    {
+        if (executor.cores.empty())
+        {
+            for (int core = 0; core < m_coreCount; ++core)
+            {
+                executor.cores.push_back(core);
+            }
+        }
+
+        render.cores = reserved;
+        executor.cores.erase(std::remove(executor.cores.begin(), executor.cores.end(), reserved[0]),
+                             executor.cores.end());
+        if (executor.cores.empty())
+        {
+            std::cout << "Thread placement: the executor shares the reserved core, "
+                      << "it has no other" << std::endl;
+            executor.cores = reserved;
+        }
+    }
+
+    ParseDecodeThreading(values[OPTION_DECODE_THREADING], values[OPTION_DECODE_THREADS]);
+
+    m_configured = false;
+    for (int role = 0; role < ROLE_TOTAL; ++role)
+    {
+        if (! m_placements[role].cores.empty() || m_placements[role].nice != 0)
+            m_configured = true;
+    }
+}
+
+const SThreadPlacement& CThreadPlacement::GetPlacement(THREAD_ROLE role) const
+{
+    return m_placements[role];
+}
+
+const SDecodeThreading& CThreadPlacement::GetDecodeThreading() const
+{
+    return m_decodeThreading;
+}
+
+int CThreadPlacement::GetCoreBudget() const
+{
+    const std::vector<int>& cores = m_placements[ROLE_EXECUTOR].cores;
+    return cores.empty() ? QThread::idealThreadCount() : static_cast<int>(cores.size());
+}
+
+int CThreadPlacement::ReserveCores(int cores)
+{
+    QMutexLocker locker(&m_mutex);
+    const int executorCores = std::max(m_executorCores, 1);
+    const int granted = std::max(0, std::min(cores, GetCoreBudget() - executorCores - m_reservedCores));
+    m_reservedCores += granted;
+    return granted;
+}
+
+void CThreadPlacement::ReleaseCores(int cores)
+{
+    QMutexLocker locker(&m_mutex);
+    m_reservedCores -= cores;
+}
+
+int CThreadPlacement::TakeExecutorCores(int minimum)
+{
+    QMutexLocker locker(&m_mutex);
+    m_executorCores = std::max(GetCoreBudget() - m_reservedCores, minimum);
+    return m_executorCores;
+}
+
+std::vector<int> CThreadPlacement::GetCores(THREAD_ROLE role) const
+{
+    std::vector<int> cores = m_placements[role].cores;
+    if (cores.empty())
+    {
+        for (int core = 0; core < m_coreCount; ++core)
+        {
+            cores.push_back(core);
+        }
+    }
+    return cores;
+}
+
+int CThreadPlacement::PlaceCurrentThread(THREAD_ROLE role, const QString& name)
+{
+    bool placed = true;
+    if (m_configured)
+    {
+        // A new thread starts out with the cores and the nice value of the
+        // thread which started it, so roles without a setting get the
+        // defaults back
+        const bool coresSet = SetCurrentThreadCores(GetCores(role));
+        const bool niceSet = SetCurrentThreadNice(m_placements[role].nice);
+        if (! coresSet || ! niceSet)
+        {
+            std::cout << "Thread placement: " << name.toStdString() << " keeps its "
+                      << (coresSet ? "nice value" : "cores") << std::endl;
+        }
+        placed = coresSet && niceSet;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    const int id = m_threadCount;
+    if (id >= kMaxPlacedThreads)
+    {
+        return -1;
+    }
+
+    SThreadRecord& record = m_threads[id];
+    record.name = name;
+    record.role = role;
+    record.placed = placed;
+    record.cpuTimeMs = GetCurrentThreadCpuTimeMs();
+    record.migrations = 0;
+    record.lastCore = GetCurrentCore();
+    record.samples = 0;
+
+    // readers only look at records below the count
+    m_threadCount = id + 1;
+    return id;
+}
+
+void CThreadPlacement::SampleThread(int id)
+{
+    if (id < 0)
+    {
+        return;
+    }
+
+    SThreadRecord& record = m_threads[id];
+    const int core = GetCurrentCore();
+    if (core != record.lastCore)
+    {
+        record.migrations++;
+        record.lastCore = core;
+    }
+
+    if (++record.samples % kCpuTimeSampleInterval == 0)
+    {
+        record.cpuTimeMs = GetCurrentThreadCpuTimeMs();
+    }
+}
+
+std::vector<SThreadUsage> CThreadPlacement::GetUsage() const
+{
+    std::vector<SThreadUsage> usage;
+    const int count = m_threadCount;
+    for (int i = 0; i < count; ++i)
+    {
+        const SThreadRecord& record = m_threads[i];
+        SThreadUsage thread;
+        thread.name = record.name;
+        thread.role = record.role;
+        thread.placed = record.placed;
+        thread.cpuTimeMs = record.cpuTimeMs;
+        thread.migrations = record.migrations;
+        thread.lastCore = record.lastCore;
+        usage.push_back(thread);
+    }
+    return usage;
+}
+
+void CThreadPlacement::PrintUsage() const
+{
+    std::cout << "Threads:" << std::endl;
+    for (int role = 0; role < ROLE_TOTAL; ++role)
+    {
+        const SThreadPlacement& placement = m_placements[role];
+        std::cout << "  " << GetRoleName(static_cast<THREAD_ROLE>(role)) << " cores ";
+        if (placement.cores.empty())
+            std::cout << "all";
+        for (size_t i = 0; i < placement.cores.size(); ++i)
+        {
+            std::cout << (i ? "," : "") << placement.cores[i];
+        }
+        std::cout << ", nice " << placement.nice << std::endl;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        std::cout << "  core budget " << GetCoreBudget() << ": " << m_executorCores
+                  << " executor threads, " << m_reservedCores << " cores for other threads"
+                  << std::endl;
+    }
+
+    const std::vector<SThreadUsage> usage = GetUsage();
+    for (auto& thread : usage)
+    {
+        std::cout << "  " << thread.name.toStdString() << ": "
+                  << thread.cpuTimeMs << " ms CPU, "
+                  << thread.migrations << " migrations, on core " << thread.lastCore
+                  << (thread.placed ? "" : ", not placed") << std::endl;
+    }
+}
+
+std::vector<int> CThreadPlacement::ParseCores(const QString& list, const QString& option) const
+{
+    std::vector<int> cores;
+    const QStringList items = list.split(',', QString::SkipEmptyParts);
+    for (auto& item : items)
+    {
+        bool ok;
+        const int core = item.trimmed().toInt(&ok);
+        if (! ok || core < 0 || core >= m_coreCount)
+        {
+            std::cout << "Thread placement: " << option.toStdString() << ": no core "
+                      << item.toStdString() << std::endl;
+            continue;
+        }
+
+        if (std::find(cores.begin(), cores.end(), core) == cores.end())
+            cores.push_back(core);
+    }
+    return cores;
+}
+
+void CThreadPlacement::ParseDecodeThreading(const QString& mode, const QString& threads)
+{
+    if (! mode.isEmpty())
+    {
+        const int count = sizeof(kDecodeThreadingNames) / sizeof(kDecodeThreadingNames[0]);
+        const int index = std::find(kDecodeThreadingNames, kDecodeThreadingNames + count,
+                                    mode.trimmed().toLower().toStdString()) - kDecodeThreadingNames;
+        if (index < count)
+        {
+            m_decodeThreading.mode = static_cast<DECODE_THREADING>(index);
+        }
+        else
+        {
+            std::cout << "Thread placement: " << kOptions[OPTION_DECODE_THREADING].name
+                      << ": single, frame, slice or both" << std::endl;
+        }
+    }
+
+    if (! threads.isEmpty())
+    {
+        bool ok;
+        const int count = threads.trimmed().toInt(&ok);
+        if (ok && count >= 0)
+        {
+            m_decodeThreading.threads = count;
+        }
+        else
+        {
+            std::cout << "Thread placement: " << kOptions[OPTION_DECODE_THREADS].name
+                      << ": 0 or more threads" << std::endl;
+        }
+    }
+}
+
+int CThreadPlacement::ParseNice(const QString& value, const QString& option) const
+{
+    if (value.isEmpty())
+    {
+        return 0;
+    }
+
+    bool ok;
+    const int nice = value.trimmed().toInt(&ok);
+    if (! ok || nice < kMinNice || nice > kMaxNice)
+    {
+        std::cout << "Thread placement: " << option.toStdString() << ": nice values go from "
+                  << kMinNice << " to " << kMaxNice << std::endl;
+        return 0;
+    }
+    return nice;
+}
+
+// -----------------------------------------------------------------------------
+// CPlacementScope Functions
+// -----------------------------------------------------------------------------
+CPlacementScope::CPlacementScope(THREAD_ROLE role): m_placed(false), m_priority(0)
+{
+    const CThreadPlacement& placement = CThreadPlacement::GetInstance();
+    if (! placement.m_configured || ! GetCurrentThreadCores(m_cores))
+    {
+        return;
+    }
+
+    m_placed = SetCurrentThreadCores(placement.GetCores(role));
+
+    // Without the right to raise priorities a higher nice value couldn't be
+    // undone, the thread keeps its own then
+    const int nice = placement.GetPlacement(role).nice;
+    int current;
+    if (m_placed && GetCurrentThreadPriority(current))
+    {
+        m_priority = current;
+#if defined(__linux__)
+        if (nice <= current)
+#endif
+            SetCurrentThreadNice(nice);
+    }
+}
+
+CPlacementScope::~CPlacementScope()
+{
+    if (m_placed)
+    {
+        SetCurrentThreadCores(m_cores);
+        SetCurrentThreadPriority(m_priority);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// CCoreReservation Functions
+// -----------------------------------------------------------------------------
+CCoreReservation::CCoreReservation(int cores):
+    m_cores(CThreadPlacement::GetInstance().ReserveCores(cores))
+{
+}
+
+CCoreReservation::~CCoreReservation()
+{
+    CThreadPlacement::GetInstance().ReleaseCores(m_cores);
+}
+
+int CCoreReservation::GetCores() const
+{
+    return m_cores;
+}
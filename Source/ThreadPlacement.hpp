@@ -0,0 +1,206 @@
+#ifndef THREADPLACEMENT_HPP
+#define THREADPLACEMENT_HPP
+
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Where the threads of the demo run. The render thread and the executor
+// threads, which convert the video frames and compute the fractal, each get
+// a set of cores and a nice value. They are read from the [threads] section
+// of ThreadedMoviePlayback.ini next to the executable and then from the
+// command line. A core reserved for rendering is taken away from the
+// executor. The executor threads and the threads of the video decoder share
+// the cores of the executor, so together they don't run more threads than
+// there are cores. The demux and decode stages of the video start with the
+// placement of the executor.
+// ----------------------------------------------------------------------------
+
+// Threads placed over the run time of the program, later ones are not tracked
+const int kMaxPlacedThreads = 256;
+
+enum THREAD_ROLE
+{
+    ROLE_RENDER,
+    ROLE_EXECUTOR,
+    ROLE_TOTAL
+};
+
+// Threads the video decoder runs of its own
+enum DECODE_THREADING
+{
+    // decodes on the calling executor thread only
+    DECODE_SINGLE,
+    // one frame per thread, adds a frame of delay per thread
+    DECODE_FRAME,
+    // parts of one frame per thread, if the stream has several slices
+    DECODE_SLICE,
+    // the decoder picks frames or slices, whichever the codec supports
+    DECODE_FRAME_SLICE
+};
+
+struct SDecodeThreading
+{
+    SDecodeThreading();
+
+    DECODE_THREADING mode;
+    // 0 sizes them by the frame size, out of the core budget
+    int threads;
+};
+
+struct SThreadPlacement
+{
+    SThreadPlacement();
+
+    // empty for all cores
+    std::vector<int> cores;
+    // SCHED_OTHER nice value from -20 (first) to 19 (last). Windows has no
+    // nice values, it is mapped onto the thread priority levels there.
+    int nice;
+};
+
+struct SThreadUsage
+{
+    QString name;
+    THREAD_ROLE role;
+    // false if the OS refused the cores or the nice value
+    bool placed;
+    qint64 cpuTimeMs;
+    // core changes seen between two samples of the thread
+    unsigned long long migrations;
+    int lastCore;
+};
+
+class CThreadPlacement
+{
+public:
+    static CThreadPlacement& GetInstance();
+
+    /**
+     * Reads the settings file, then @p arguments. Must be called before the
+     * first thread is placed. Bad values are reported on the console and
+     * left out. Without any setting threads are left where the OS puts them.
+     *
+     * --render-cores 0,1          renderCores=0,1
+     * --render-nice -5            renderNice=-5
+     * --executor-cores 2,3        executorCores=2,3
+     * --executor-nice 5           executorNice=5
+     * --reserve-render-core 1     reservedRenderCore=1
+     * --decode-threading frame    decodeThreading=frame
+     * --decode-threads 4          decodeThreads=4
+     */
+    void Configure(const QStringList& arguments);
+    const SThreadPlacement& GetPlacement(THREAD_ROLE role) const;
+    const SDecodeThreading& GetDecodeThreading() const;
+
+    // Cores shared by the executor threads and other busy threads
+    int GetCoreBudget() const;
+    /**
+     * Takes up to @p cores of the budget for threads outside the executor
+     * and returns how many it got. At least one core is left to the
+     * executor. Once the executor has started it keeps its threads, then
+     * only cores released before are handed out again.
+     */
+    int ReserveCores(int cores);
+    void ReleaseCores(int cores);
+    // Called by the executor as it starts, returns its number of threads
+    int TakeExecutorCores(int minimum);
+
+    /**
+     * Moves the calling thread to the cores of @p role and sets its nice
+     * value. Returns the id the thread passes to SampleThread(), -1 if it
+     * isn't tracked.
+     */
+    int PlaceCurrentThread(THREAD_ROLE role, const QString& name);
+    // Called by the thread itself, once per job or frame
+    void SampleThread(int id);
+    std::vector<SThreadUsage> GetUsage() const;
+    // Per thread usage to the console
+    void PrintUsage() const;
+
+private:
+    friend class CPlacementScope;
+
+    CThreadPlacement();
+    CThreadPlacement(const CThreadPlacement&) = delete;
+    CThreadPlacement& operator=(const CThreadPlacement&) = delete;
+
+    struct SThreadRecord
+    {
+        QString name;
+        THREAD_ROLE role;
+        bool placed;
+        std::atomic<qint64> cpuTimeMs;
+        std::atomic<unsigned long long> migrations;
+        std::atomic<int> lastCore;
+        // only touched by the thread itself
+        unsigned int samples;
+    };
+
+    // The cores of @p role, all cores if it has no setting
+    std::vector<int> GetCores(THREAD_ROLE role) const;
+    // Cores of the list which exist, in the order given
+    std::vector<int> ParseCores(const QString& list, const QString& option) const;
+    int ParseNice(const QString& value, const QString& option) const;
+    void ParseDecodeThreading(const QString& mode, const QString& threads);
+
+    static CThreadPlacement s_instance;
+
+    SThreadPlacement m_placements[ROLE_TOTAL];
+    SDecodeThreading m_decodeThreading;
+    // threads are only moved if some placement was set
+    bool m_configured;
+    int m_coreCount;
+
+    // Records are never moved, a thread samples its own without a lock.
+    // The mutex guards the core budget as well.
+    mutable QMutex m_mutex;
+    int m_reservedCores;
+    // 0 until the executor has started
+    int m_executorCores;
+    SThreadRecord m_threads[kMaxPlacedThreads];
+    std::atomic<int> m_threadCount;
+};
+
+/**
+ * Gives the calling thread the placement of @p role until the scope ends.
+ * Threads a library starts in the meantime start out with it on Linux,
+ * e.g. the decoder threads FFmpeg starts when it opens a codec.
+ */
+class CPlacementScope
+{
+public:
+    explicit CPlacementScope(THREAD_ROLE role);
+    ~CPlacementScope();
+
+private:
+    CPlacementScope(const CPlacementScope&) = delete;
+    CPlacementScope& operator=(const CPlacementScope&) = delete;
+
+    bool m_placed;
+    // of the thread before the scope
+    std::vector<int> m_cores;
+    int m_priority;
+};
+
+// Cores of the budget held for the lifetime of the object
+class CCoreReservation
+{
+public:
+    // Takes up to @p cores, see CThreadPlacement::ReserveCores()
+    explicit CCoreReservation(int cores);
+    ~CCoreReservation();
+
+    int GetCores() const;
+
+private:
+    CCoreReservation(const CCoreReservation&) = delete;
+    CCoreReservation& operator=(const CCoreReservation&) = delete;
+
+    int m_cores;
+};
+
+#endif // THREADPLACEMENT_HPP
@@ -1,152 +1,316 @@
 #include "Stdafx.hpp"
 #include "Worker.hpp"
 #include "TextureObject.hpp"
+#include "Executor.hpp"
+#include <QElapsedTimer>
+#include <algorithm>
 #include <cassert>
 
-CWorker::CWorker(): m_pause(true), m_stop(false), m_restart(false),
-                    m_inPauseState(false), m_inSwapWaitState(false),
-                    m_doubleBuffer(false),
-                    m_buffer(nullptr), m_texObj(nullptr)
+namespace
 {
+    // How long an idle producer waits before checking for new content
+    const int kIdleWaitMs = 5;
+    // How often a FIFO producer checks whether its frame was displayed. The
+    // render thread doesn't signal, so it never has to take the mutex.
+    const int kSwapPollMs = 1;
 }
 
-CWorker::~CWorker()
+SDeadlineStats::SDeadlineStats(): skippedFrames(0), reducedFrames(0)
+{
+}
+
+SCancelStats::SCancelStats(): requests(0), cancelledFrames(0), overBudget(0), lastLatencyUs(0),
+                              maxLatencyUs(0)
+{
+}
+
+CWorker::CWorker(): m_pause(true), m_stop(false), m_scheduled(false), m_producing(false),
+                    m_frameFull(false), m_frameVersion(0),
+                    m_doubleBuffer(false), m_ringDepth(0), m_publishPartial(true),
+                    m_handoffPolicy(HANDOFF_FIFO), m_deadlineMs(0), m_frameCostMs(0),
+                    m_displayMs(0),
+                    m_buffer(nullptr), m_producerBuffer(nullptr), m_nextBuffer(nullptr), m_texObj(nullptr)
 {
 }
 
-void CWorker::run()
+CWorker::~CWorker()
 {
+    Stop();
+
+    // a queued Step() still refers to this worker
+    QMutexLocker locker(&m_mutex);
+    while (m_scheduled)
     {
-        QMutexLocker locker(&m_mutex);
-        assert(m_pause);
+        m_parkedSignal.wait(&m_mutex);
+    }
+    delete m_nextBuffer.exchange(nullptr);
+}
+
+void CWorker::Step()
+{
+    QMutexLocker locker(&m_mutex);
 
-        m_pauseSignal.wakeOne();
-        m_inPauseState = true;
-        m_runSignal.wait(&m_mutex);
-        m_inPauseState = false;
+    if (Park())
+    {
+        return;
     }
 
-    forever
+    if (!m_frameFull)
     {
-        if (!m_pause)
+        m_producing = true;
+        locker.unlock();
+        FollowRequestedSize();
+
+        CExecutor& executor = CExecutor::GetInstance();
+        const int periodMs = m_texObj->GetFramePeriodMs();
+        const qint64 startMs = executor.GetTimeMs();
+        if (SkipLateFrame(startMs, periodMs))
         {
-            m_texObj->DoUpdate(m_buffer.get());
+            locker.relock();
+            m_producing = false;
+            m_parkedSignal.wakeAll();
+            if (!Park())
+            {
+                ScheduleStep(0);
+            }
+            return;
         }
 
+        const qint64 displayMs = NextDisplayTime(startMs, periodMs);
+        const bool produced = m_texObj->ProduceFrame(m_producerBuffer, displayMs, m_cancel);
+        const qint64 doneMs = executor.GetTimeMs();
+        locker.relock();
+        m_producing = false;
+        m_parkedSignal.wakeAll();
+
+        // The buffers may be replaced while paused, the frame is dropped
+        if (Park())
         {
-            QMutexLocker locker(&m_mutex);
+            return;
+        }
 
-            if (m_pause)
-            {
-                m_pauseSignal.wakeOne();
-                m_inPauseState = true;
-                m_runSignal.wait(&m_mutex);
-                m_inPauseState = false;
-            }
+        // Nothing changed since the latest frame, don't hand out a copy
+        // of it. Wait a little before asking the producer again.
+        if (!produced)
+        {
+            m_deadlineMs = doneMs + kIdleWaitMs + periodMs;
+            ScheduleStep(kIdleWaitMs);
+            return;
+        }
 
-            if (m_stop)
-            {
-                m_pauseSignal.wakeOne();
-                break;
-            }
+        m_displayMs = displayMs;
+        // a running average, so one slow frame doesn't cause a skip
+        m_frameCostMs = (3 * m_frameCostMs + (doneMs - startMs) + 2) / 4;
+
+        // We are ready to swap working buffer, set working buffer status
+        // to full so render (paintGL()) can swap it with stable buffer
+        // later.
+        m_producerBuffer->SetWorkingBufferFull();
+        // the double buffer shows its frame before the swap
+        HandOverResizedBuffer();
+        m_frameFull = true;
+        m_frameVersion = m_producerBuffer->GetWorkingVersion();
+    }
 
-            if (m_restart)
-            {
-                m_restart = false;
-                continue;
-            }
+    // The executor thread is free for other jobs in the meantime
+    if (!m_producerBuffer->CanWeSwapWorkingBuffer())
+    {
+        ScheduleStep(kSwapPollMs);
+        return;
+    }
 
-            // We are ready to swap working buffer, set working buffer status
-            // to full so render (paintGL()) can swap it with stable buffer
-            // later.
-            m_buffer->SetWorkingBufferFull();
-            if (!m_buffer->CanWeSwapWorkingBuffer())
-            {
-                m_inSwapWaitState = true;
-                m_swapBufferSignal.wait(&m_mutex);
-                m_inSwapWaitState = false;
-            }
+    m_producerBuffer->SwapWorkingBuffer();
+    HandOverResizedBuffer();
+    m_frameFull = false;
+    m_publishPartial = false;
 
-            m_buffer->SwapWorkingBuffer();
-        }
+    // The next frame is due one period after this one is handed off, which
+    // is when it's shown if the render thread paces the worker
+    m_deadlineMs = CExecutor::GetInstance().GetTimeMs() + m_texObj->GetFramePeriodMs();
+    ScheduleStep(0);
+}
+
+qint64 CWorker::NextDisplayTime(qint64 nowMs, int periodMs) const
+{
+    // Frames stay on a grid of whole periods, so an animation moves on by
+    // the same step from frame to frame, whenever a frame is computed
+    qint64 displayMs = m_displayMs + periodMs;
+
+    const qint64 earliestMs = nowMs + m_frameCostMs;
+    if (displayMs < earliestMs)
+    {
+        displayMs += (earliestMs - displayMs + periodMs - 1) / periodMs * periodMs;
+    }
+
+    // latest-wins never waits for the render thread, it mustn't run ahead
+    const int queuedFrames = m_ringDepth ? m_ringDepth : 1;
+    const qint64 latestMs = nowMs + (queuedFrames + 1) * periodMs;
+    if (displayMs > latestMs)
+    {
+        displayMs -= (displayMs - latestMs + periodMs - 1) / periodMs * periodMs;
+    }
+    return displayMs;
+}
+
+void CWorker::ScheduleStep(int delayMs)
+{
+    const Job step = [this]() { Step(); };
+    if (delayMs > 0)
+        CExecutor::GetInstance().SubmitDelayed(step, delayMs, m_deadlineMs);
+    else
+        CExecutor::GetInstance().Post(step, m_deadlineMs);
+}
+
+bool CWorker::SkipLateFrame(qint64 nowMs, int periodMs)
+{
+    const qint64 finishMs = nowMs + m_frameCostMs;
+    if (finishMs <= m_deadlineMs)
+    {
+        return false;
+    }
+
+    // Leaving the frame out only helps if the next one then makes it
+    if (finishMs <= m_deadlineMs + periodMs && m_texObj->SkipFrame(m_cancel))
+    {
+        m_deadlineStats.skippedFrames++;
+        m_deadlineMs += periodMs;
+        return true;
+    }
+
+    if (m_texObj->ReduceFrameQuality())
+    {
+        m_deadlineStats.reducedFrames++;
+    }
+    return false;
+}
+
+bool CWorker::Park()
+{
+    if (!m_pause && !m_stop)
+    {
+        return false;
+    }
+
+    m_scheduled = false;
+    m_parkedSignal.wakeAll();
+    return true;
+}
+
+void CWorker::DropResetFrame()
+{
+    // Publishing it anyway would hand out whatever the slot holds now. For
+    // the double buffer a new version means the render thread took the
+    // frame, which frees the slot just the same.
+    if (m_frameFull && m_producerBuffer->GetWorkingVersion() != m_frameVersion)
+    {
+        m_frameFull = false;
     }
 }
 
 const CBuffer* CWorker::GetUpdatedBufferAndSignalWorker()
 {
-    QMutexLocker locker(&m_mutex);
+    // The worker left the old buffer when it started the new one, frames
+    // still queued in it are dropped
+    CWorkerBuffer* resized = m_nextBuffer.exchange(nullptr);
+    if (resized)
+    {
+        m_buffer.reset(resized);
+    }
 
+    // otherwise m_buffer is only replaced while the worker is paused by
+    // this thread
     if (m_buffer->CanWeSwapStableBuffer())
     {
         m_buffer->SwapStableBuffer();
-
-        locker.unlock();
-        m_swapBufferSignal.wakeOne();
     }
 
     return m_buffer.get();
 }
 
-void CWorker::Pause()
+void CWorker::PublishPartialResult()
 {
     QMutexLocker locker(&m_mutex);
 
-    if (m_inPauseState)
+    // Don't overwrite a finished frame which is not displayed yet
+    if (! m_publishPartial || m_pause || m_doubleBuffer ||
+        m_producerBuffer->CanWeSwapStableBuffer())
     {
         return;
     }
 
-    if (m_inSwapWaitState)
-        m_swapBufferSignal.wakeOne();
-
-    if (m_texObj)
-        m_texObj->StopUpdate();
-
-    m_pause = true;
-    m_pauseSignal.wait(&m_mutex);
+    m_producerBuffer->InitIntermediateBuffer(m_producerBuffer->GetWorkingBuffer(),
+                                             m_producerBuffer->GetSize());
+    HandOverResizedBuffer();
 }
 
-void CWorker::Resume(bool restartCompute)
+void CWorker::Pause()
 {
     QMutexLocker locker(&m_mutex);
 
-    // Don't resume if there is no work to do
-    if (m_texObj == nullptr) {
+    if (m_pause && !m_producing)
+    {
         return;
     }
 
-    m_restart = restartCompute;
-    if (m_inPauseState)
-    {
-        m_pause = false;
+    // A Step() still queued parks as soon as it runs, without touching
+    // the buffers
+    m_pause = true;
+    CancelFrame();
 
-        locker.unlock();
-        m_runSignal.wakeOne();
+    SettleResize();
+}
+
+void CWorker::CancelFrame()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool producing = m_producing;
+    m_cancel.Cancel();
+    while (m_producing)
+    {
+        m_parkedSignal.wait(&m_mutex);
     }
+
+    const qint64 latencyUs = timer.nsecsElapsed() / 1000;
+    m_cancelStats.requests++;
+    if (producing)
+        m_cancelStats.cancelledFrames++;
+    if (latencyUs > kMaxCancelLatencyUs)
+        m_cancelStats.overBudget++;
+    m_cancelStats.lastLatencyUs = latencyUs;
+    m_cancelStats.maxLatencyUs = std::max(m_cancelStats.maxLatencyUs, latencyUs);
 }
 
-void CWorker::Stop()
+void CWorker::Resume(bool restartCompute)
 {
     QMutexLocker locker(&m_mutex);
 
-    if (m_stop) {
+    // Don't resume if there is no work to do
+    if (m_texObj == nullptr || m_stop) {
         return;
     }
 
-    m_stop = true;
+    if (restartCompute)
+        m_publishPartial = true;
 
-    if (m_inSwapWaitState)
+    m_pause = false;
+    m_cancel.Reset();
+    DropResetFrame();
+    if (!m_scheduled)
     {
-        m_swapBufferSignal.wakeOne();
+        m_scheduled = true;
+        m_deadlineMs = CExecutor::GetInstance().GetTimeMs() + m_texObj->GetFramePeriodMs();
+        ScheduleStep(0);
     }
+}
 
-    if (m_inPauseState)
-    {
-        m_pause = false;
-        m_runSignal.wakeOne();
-    }
+void CWorker::Stop()
+{
+    QMutexLocker locker(&m_mutex);
 
-    m_pauseSignal.wait(&m_mutex);
+    m_stop = true;
+    CancelFrame();
 }
 
 void CWorker::UseDoubleBuffer()
@@ -158,55 +322,168 @@ void CWorker::UseDoubleBuffer()
 
     std::unique_ptr<CWorkerBuffer> old = std::move(m_buffer);
     m_buffer.reset(new CDoubleBuffer);
+    m_buffer->SetHandoffStats(&m_handoffStats);
+    m_handoffStats.Reset();
 
-    if (old != false)
+    if (old)
     {
-        CloneOldBufferResultToNewBuffer(old.get(), m_buffer.get());
+        m_buffer->MoveFramesFrom(*old);
     }
     m_doubleBuffer = true;
+    m_ringDepth = 0;
+    m_producerBuffer = m_buffer.get();
 }
 
 void CWorker::UseTripleBuffer()
 {
-    if (!m_doubleBuffer && m_buffer)
+    if (!m_doubleBuffer && !m_ringDepth && m_buffer)
+    {
+        return;
+    }
+
+    std::unique_ptr<CWorkerBuffer> old = std::move(m_buffer);
+    m_buffer.reset(new CTripleBuffer(m_handoffPolicy));
+    m_buffer->SetHandoffStats(&m_handoffStats);
+    m_handoffStats.Reset();
+
+    if (old)
+    {
+        m_buffer->MoveFramesFrom(*old);
+    }
+    m_doubleBuffer = false;
+    m_ringDepth = 0;
+    m_producerBuffer = m_buffer.get();
+}
+
+void CWorker::UseRingBuffer(int depth)
+{
+    if (m_ringDepth == depth && m_buffer)
     {
         return;
     }
 
     std::unique_ptr<CWorkerBuffer> old = std::move(m_buffer);
-    m_buffer.reset(new CTripleBuffer);
+    m_buffer.reset(new CRingBuffer(depth));
+    m_buffer->SetHandoffStats(&m_handoffStats);
+    m_handoffStats.Reset();
 
-    if (old != false)
+    if (old)
     {
-        CloneOldBufferResultToNewBuffer(old.get(), m_buffer.get());
+        m_buffer->MoveFramesFrom(*old);
     }
     m_doubleBuffer = false;
+    m_ringDepth = depth;
+    m_producerBuffer = m_buffer.get();
 }
 
-void CWorker::CloneOldBufferResultToNewBuffer(CWorkerBuffer* oldbuf, CWorkerBuffer* newbuf)
+void CWorker::SetHandoffPolicy(HANDOFF_POLICY policy)
 {
-    newbuf->SetPixelSize(oldbuf->GetPixelSize());
-    newbuf->SetTextureSize(oldbuf->GetWidth(), oldbuf->GetHeight());
+    m_handoffPolicy = policy;
 
-    // choose an updated buffer to copy
-    if (oldbuf->CanWeSwapStableBuffer()) {
-        newbuf->InitIntermediateBuffer(oldbuf->GetIntermediateBuffer(),
-                                       oldbuf->GetSize());
+    if (m_buffer)
+    {
+        m_buffer->SetHandoffPolicy(policy);
+        m_handoffStats.Reset();
     }
-    else {
-        newbuf->InitAllInternalBuffers(oldbuf->GetStableBuffer(),
-                                       oldbuf->GetSize());
+}
+
+CWorkerBuffer* CWorker::CreateBuffer()
+{
+    CWorkerBuffer* buffer;
+    if (m_doubleBuffer)
+        buffer = new CDoubleBuffer;
+    else if (m_ringDepth)
+        buffer = new CRingBuffer(m_ringDepth);
+    else
+        buffer = new CTripleBuffer(m_handoffPolicy);
+
+    buffer->SetHandoffStats(&m_handoffStats);
+    return buffer;
+}
+
+void CWorker::FollowRequestedSize()
+{
+    int width, height;
+    m_texObj->GetRequestedSize(width, height);
+    if (width <= 0 || (width == m_producerBuffer->GetWidth() &&
+                       height == m_producerBuffer->GetHeight()))
+    {
+        return;
+    }
+
+    // A resized buffer the render thread didn't take yet is of no use
+    // anymore. If it took it, it owns it now.
+    std::unique_ptr<CWorkerBuffer> untaken(m_nextBuffer.exchange(nullptr));
+
+    // The render thread keeps showing its buffer while the new one is
+    // filled, so nobody waits for anybody. The slabs come from the frame
+    // pool and need no clearing.
+    std::unique_ptr<CWorkerBuffer> resized(CreateBuffer());
+    resized->SetPixelSize(m_producerBuffer->GetPixelSize());
+    resized->SetRowAlignment(m_producerBuffer->GetRowAlignment());
+    resized->SetLayout(m_producerBuffer->GetLayout());
+    resized->SetTextureSize(width, height);
+
+    m_producerBuffer = resized.get();
+    m_resizedBuffer = std::move(resized);
+}
+
+void CWorker::HandOverResizedBuffer()
+{
+    // only once there is a frame for the render thread to take
+    if (m_resizedBuffer && m_resizedBuffer->CanWeSwapStableBuffer())
+    {
+        m_nextBuffer = m_resizedBuffer.release();
+    }
+}
+
+void CWorker::SettleResize()
+{
+    CWorkerBuffer* resized = m_nextBuffer.exchange(nullptr);
+    if (resized)
+    {
+        m_buffer.reset(resized);
     }
+
+    // Without a frame it is dropped, the worker makes a new one when it
+    // is resumed and the size still differs
+    m_resizedBuffer.reset();
+    m_producerBuffer = m_buffer.get();
 }
 
 void CWorker::BindTextureObject(CTextureObject* texObj)
 {
     m_texObj = texObj;
     m_buffer->SetPixelSize(texObj->GetBuffer()->GetPixelSize());
+    m_buffer->SetRowAlignment(texObj->GetBuffer()->GetRowAlignment());
+    m_buffer->SetLayout(texObj->GetBuffer()->GetLayout());
     texObj->m_worker = this;
 }
 
 CBuffer* CWorker::GetInternalBuffer()
 {
-    return m_buffer.get();
+    return m_producerBuffer;
+}
+
+void CWorker::AddStorage(SFrameMemory& memory) const
+{
+    if (m_buffer)
+    {
+        m_buffer->AddStorage(memory);
+    }
+}
+
+const SHandoffStats& CWorker::GetHandoffStats() const
+{
+    return m_handoffStats;
+}
+
+const SDeadlineStats& CWorker::GetDeadlineStats() const
+{
+    return m_deadlineStats;
+}
+
+const SCancelStats& CWorker::GetCancelStats() const
+{
+    return m_cancelStats;
 }
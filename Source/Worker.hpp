@@ -1,52 +1,157 @@
 #ifndef WORKER_HPP
 #define WORKER_HPP
 
+#include <atomic>
 #include <memory>
-#include <QThread>
+#include <QMutex>
 #include <QWaitCondition>
+#include "Buffer.hpp"
+#include "CancelToken.hpp"
 
 // ----------------------------------------------------------------------------
-// Worker thread for texture object update
+// Producer of a texture object. It runs one frame at a time as a job on the
+// shared executor and submits the next one when the frame is handed off.
+// Every frame job carries the deadline of its frame, one frame period after
+// the previous one, and the executor runs the earliest deadline first.
 // ----------------------------------------------------------------------------
-class CBuffer;
-class CWorkerBuffer;
 class CTextureObject;
 
-class CWorker : public QThread
+// Frames which could not make their deadline
+struct SDeadlineStats
+{
+    SDeadlineStats();
+
+    // left out to catch up
+    std::atomic<unsigned long long> skippedFrames;
+    // produced in a cheaper version
+    std::atomic<unsigned long long> reducedFrames;
+};
+
+// How long Pause() and Stop() waited for the frame in progress. Only touched
+// by the render thread.
+struct SCancelStats
+{
+    SCancelStats();
+
+    unsigned long long requests;
+    // requests which found a frame in progress, the others hardly wait
+    unsigned long long cancelledFrames;
+    // waits longer than kMaxCancelLatencyUs
+    unsigned long long overBudget;
+    qint64 lastLatencyUs;
+    qint64 maxLatencyUs;
+};
+
+class CWorker
 {
 public:
     CWorker();
     virtual ~CWorker();
 
-    void run() override;
-    // You can call Resume() or Stop() after Pause()
+    // You can call Resume() or Stop() after Pause(). Pause() and Stop()
+    // cancel the frame in progress and return once the producer has let go
+    // of the buffers, a frame finished after Pause() is dropped. A finished
+    // frame still waiting for a free slot is handed off after Resume(),
+    // unless the buffers were reset in the meantime.
     void Pause();
     void Stop();
+    // restartCompute shows partial results again, as after the start
     void Resume(bool restartCompute);
 
+    // Called by the render thread, never blocks or locks. After a resize it
+    // switches over to the buffer of the new size once that has a frame.
     const CBuffer* GetUpdatedBufferAndSignalWorker();
+    // Called by DoUpdate() when the working buffer already holds a complete
+    // low quality image. It is shown until the full frame is ready, but only
+    // for the first frame after start or restart and in triple buffer mode.
+    void PublishPartialResult();
 
     void UseDoubleBuffer();
     void UseTripleBuffer();
+    // Lets the worker run up to depth frames ahead of the render thread
+    void UseRingBuffer(int depth);
+    // Only used by the triple buffer, the double buffer is always FIFO
+    void SetHandoffPolicy(HANDOFF_POLICY policy);
     void BindTextureObject(CTextureObject* texObj);
+    // The buffer the worker writes to, the same one the render thread reads
+    // from while the worker is paused
     CBuffer* GetInternalBuffer();
+    // Adds the frame storage the render thread uses, a buffer being filled
+    // for a resize is left out
+    void AddStorage(SFrameMemory& memory) const;
+    const SHandoffStats& GetHandoffStats() const;
+    const SDeadlineStats& GetDeadlineStats() const;
+    const SCancelStats& GetCancelStats() const;
 
 private:
-    void CloneOldBufferResultToNewBuffer(CWorkerBuffer* oldbuf, CWorkerBuffer* newbuf);
+    CWorker(const CWorker&) = delete;
+    CWorker& operator=(const CWorker&) = delete;
+
+    // One step of the producer loop, run on the executor
+    void Step();
+    // Submits the next Step(), after delayMs if it has to wait for something
+    void ScheduleStep(int delayMs);
+    // Skips or reduces the next frame if it would miss its deadline. Returns
+    // true if it was skipped.
+    bool SkipLateFrame(qint64 nowMs, int periodMs);
+    // Display time of the next frame: one period after the previous one,
+    // whole periods later if it can't be done by then, and no further
+    // ahead than the buffer can queue frames
+    qint64 NextDisplayTime(qint64 nowMs, int periodMs) const;
+    // Returns true and lets the destructor go on if it is waiting
+    bool Park();
+    // Cancels the frame in progress and waits until the producer is done
+    // with it, m_mutex must be locked
+    void CancelFrame();
+    // Forgets the frame waiting for a free slot if the buffers were reset
+    // or replaced while paused
+    void DropResetFrame();
+    // An empty buffer of the current buffer mode
+    CWorkerBuffer* CreateBuffer();
+    // Worker side, before every frame
+    void FollowRequestedSize();
+    void HandOverResizedBuffer();
+    // Render thread side, with the worker paused
+    void SettleResize();
 
     QMutex m_mutex;
-    QWaitCondition m_runSignal;
-    QWaitCondition m_pauseSignal;
-    QWaitCondition m_swapBufferSignal;
+    QWaitCondition m_parkedSignal;
 
     bool m_pause;
     bool m_stop;
-    bool m_restart;
-    bool m_inPauseState;
-    bool m_inSwapWaitState;
+    // a Step() is queued or running
+    bool m_scheduled;
+    // a Step() runs the producer right now, without holding m_mutex
+    bool m_producing;
+    // the frame is in the buffer and waits for a free slot
+    bool m_frameFull;
+    // its working version, which a reset of the buffers changes
+    unsigned long long m_frameVersion;
     bool m_doubleBuffer;
+    int m_ringDepth;
+    bool m_publishPartial;
+    HANDOFF_POLICY m_handoffPolicy;
+
+    // Executor time by which the next frame should be done, and what
+    // producing a frame took recently. Only touched by the frame job.
+    qint64 m_deadlineMs;
+    qint64 m_frameCostMs;
+    // display time of the latest frame produced
+    qint64 m_displayMs;
+    SDeadlineStats m_deadlineStats;
+
+    CCancelToken m_cancel;
+    SCancelStats m_cancelStats;
 
+    // Read by the render thread
     std::unique_ptr<CWorkerBuffer> m_buffer;
+    // Written by the worker. After a resize this is a new buffer, owned by
+    // m_resizedBuffer until it holds a frame and then passed to the render
+    // thread through m_nextBuffer. The render thread frees the old one.
+    CWorkerBuffer* m_producerBuffer;
+    std::unique_ptr<CWorkerBuffer> m_resizedBuffer;
+    std::atomic<CWorkerBuffer*> m_nextBuffer;
+    SHandoffStats m_handoffStats;
     CTextureObject* m_texObj;
 };
 
@@ -1,11 +1,14 @@
 #include "Stdafx.hpp"
 #include "MainWindow.hpp"
+#include "ThreadPlacement.hpp"
 #include <QApplication>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
     CMainWindow w;
+    // after the console is opened, before show() starts the threads
+    CThreadPlacement::GetInstance().Configure(a.arguments());
     w.show();
     return a.exec();
 }